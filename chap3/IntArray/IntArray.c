@@ -1,15 +1,19 @@
 #include <jni.h>
 #include <stdio.h>
 #include "IntArray.h"   
+#include "Reduce.h"
 
-JNIEXPORT jint JNICALL 
+JNIEXPORT jlong JNICALL 
 Java_IntArray_sumArray(JNIEnv *env, jobject obj, jintArray arr)
 {
-    jint buf[10];
-    jint i, sum = 0;
-    (*env)->GetIntArrayRegion(env, arr, 0, 10, buf);
-    for (i = 0; i < 10; i++) {
-        sum += buf[i];
+    jint buf[256];
+    jsize i, n, len = (*env)->GetArrayLength(env, arr);
+    jlong sum = 0;
+    /* Copy the array a buffer at a time, whatever its length */
+    for (i = 0; i < len; i += n) {
+        n = len - i < 256 ? len - i : 256;
+        (*env)->GetIntArrayRegion(env, arr, i, n, buf);
+        sum += sumInts(buf, n);
     }
     return sum;
 }
@@ -1,12 +1,13 @@
 class IntArray {
-    private native int sumArray(int[] arr);
+    private native long sumArray(int[] arr);
     public static void main(String[] args) {
         IntArray p = new IntArray();
-        int arr[] = new int[10];
-        for (int i = 0; i < 10; i++) {
+        int n = args.length > 0 ? Integer.parseInt(args[0]) : 10;
+        int arr[] = new int[n];
+        for (int i = 0; i < n; i++) {
             arr[i] = i;
         }
-        int sum = p.sumArray(arr);
+        long sum = p.sumArray(arr);
         System.out.println("sum = " + sum);
     }
 
@@ -0,0 +1,27 @@
+#ifndef _REDUCE_H_
+#define _REDUCE_H_
+
+#include <jni.h>
+
+/*
+ * Reductions over an array of jint in C memory, such as the elements
+ * of a pinned Java int[].  Each is vectorized with AVX2 or SSE4.1 when
+ * the CPU has them, picked at run time on the first call; elsewhere a
+ * plain C loop is used.  Sums are accumulated in 64 bits and cannot
+ * overflow for any Java array.
+ */
+
+jlong sumInts(const jint *a, jsize n);
+
+/* Smallest and largest element; Integer.MAX_VALUE and MIN_VALUE,
+   respectively, if n is 0 */
+jint minInts(const jint *a, jsize n);
+jint maxInts(const jint *a, jsize n);
+
+/* Sum of the squares, exact while it stays below 2^63 */
+jlong sumSquaresInts(const jint *a, jsize n);
+
+/* "avx2", "sse4.1" or "c": which kernels the calls above use */
+const char *reduceKernels(void);
+
+#endif /* _REDUCE_H_ */
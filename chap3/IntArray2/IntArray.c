@@ -1,21 +1,231 @@
 #include <jni.h>
 #include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
 #include "IntArray.h"
+#include "Reduce.h"
+#include "Parallel.h"
 
-JNIEXPORT jint JNICALL 
+/*
+ * All four reductions pin the array with GetPrimitiveArrayCritical,
+ * which avoids the copy GetIntArrayElements may make, and hand the
+ * elements to the kernels in Reduce.c.  Nothing between Get and
+ * Release may call back into the JNI or block.
+ */
+
+JNIEXPORT jlong JNICALL 
 Java_IntArray_sumArray(JNIEnv *env, jobject obj, jintArray arr)
 {
     jint *carr;
-    jint i, sum = 0;
+    jsize len = (*env)->GetArrayLength(env, arr);
+    jlong sum;
+    carr = (*env)->GetPrimitiveArrayCritical(env, arr, NULL);
+    if (carr == NULL) {
+        return 0; /* exception occurred */
+    }
+    sum = sumInts(carr, len);
+    (*env)->ReleasePrimitiveArrayCritical(env, arr, carr, JNI_ABORT);
+    return sum;
+}
+
+JNIEXPORT jint JNICALL 
+Java_IntArray_minArray(JNIEnv *env, jobject obj, jintArray arr)
+{
+    jint *carr;
+    jsize len = (*env)->GetArrayLength(env, arr);
+    jint min;
+    carr = (*env)->GetPrimitiveArrayCritical(env, arr, NULL);
+    if (carr == NULL) {
+        return 0; /* exception occurred */
+    }
+    min = minInts(carr, len);
+    (*env)->ReleasePrimitiveArrayCritical(env, arr, carr, JNI_ABORT);
+    return min;
+}
+
+JNIEXPORT jint JNICALL 
+Java_IntArray_maxArray(JNIEnv *env, jobject obj, jintArray arr)
+{
+    jint *carr;
+    jsize len = (*env)->GetArrayLength(env, arr);
+    jint max;
+    carr = (*env)->GetPrimitiveArrayCritical(env, arr, NULL);
+    if (carr == NULL) {
+        return 0; /* exception occurred */
+    }
+    max = maxInts(carr, len);
+    (*env)->ReleasePrimitiveArrayCritical(env, arr, carr, JNI_ABORT);
+    return max;
+}
+
+JNIEXPORT jlong JNICALL 
+Java_IntArray_sumOfSquares(JNIEnv *env, jobject obj, jintArray arr)
+{
+    jint *carr;
+    jsize len = (*env)->GetArrayLength(env, arr);
+    jlong sum;
+    carr = (*env)->GetPrimitiveArrayCritical(env, arr, NULL);
+    if (carr == NULL) {
+        return 0; /* exception occurred */
+    }
+    sum = sumSquaresInts(carr, len);
+    (*env)->ReleasePrimitiveArrayCritical(env, arr, carr, JNI_ABORT);
+    return sum;
+}
+
+JNIEXPORT jstring JNICALL 
+Java_IntArray_kernels(JNIEnv *env, jclass cls)
+{
+    return (*env)->NewStringUTF(env, reduceKernels());
+}
+
+/*
+ * Streaming: GetIntArrayRegion copies the array a chunk at a time into
+ * a buffer that fits in half the L2 cache, so that the copy is still
+ * in cache when it is reduced.  Nothing stays pinned and no more than
+ * one chunk is copied, so the GC may run between chunks and memory use
+ * does not grow with the array.
+ *
+ * Each thread keeps its buffer for the next call, and on POSIX systems
+ * frees it when it exits.  On Win32 the buffer is never freed.
+ */
+
+#define MIN_CHUNK (64 * 1024)
+#define MAX_CHUNK (1024 * 1024)
+
+static jsize chunkBytes;        /* chunk size in bytes, set on first use */
+
+#ifdef _WIN32
+static THREAD_LOCAL jint *threadChunk;
+#else
+static pthread_key_t chunkKey;
+static pthread_once_t chunkOnce = PTHREAD_ONCE_INIT;
+
+static void
+makeChunkKey(void)
+{
+    pthread_key_create(&chunkKey, free);
+}
+#endif
+
+/* Half the L2 cache, within MIN_CHUNK and MAX_CHUNK */
+static jsize
+getChunkBytes(void)
+{
+    long l2 = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (l2 <= 0) {
+        l2 = 512 * 1024; /* unknown; assume a common size */
+    }
+    l2 /= 2;
+    return l2 < MIN_CHUNK ? MIN_CHUNK : l2 > MAX_CHUNK ? MAX_CHUNK : l2;
+}
+
+/* Returns this thread's chunk buffer, or NULL if out of memory */
+static jint *
+getChunk(void)
+{
+    jint *buf;
+    if (chunkBytes == 0) {
+        chunkBytes = getChunkBytes(); /* racing threads agree */
+    }
+#ifdef _WIN32
+    if ((buf = threadChunk) == NULL) {
+        buf = threadChunk = (jint *)malloc(chunkBytes);
+    }
+#else
+    pthread_once(&chunkOnce, makeChunkKey);
+    if ((buf = (jint *)pthread_getspecific(chunkKey)) == NULL &&
+        (buf = (jint *)malloc(chunkBytes)) != NULL) {
+        pthread_setspecific(chunkKey, buf);
+    }
+#endif
+    return buf;
+}
+
+JNIEXPORT jlong JNICALL 
+Java_IntArray_sumArrayChunked(JNIEnv *env, jobject obj, jintArray arr)
+{
+    jint *buf = getChunk();
+    jsize i, n, len = (*env)->GetArrayLength(env, arr);
+    jsize chunk = chunkBytes / sizeof(jint);
+    jlong sum = 0;
+    if (buf == NULL) {
+        jclass cls = (*env)->FindClass(env, "java/lang/OutOfMemoryError");
+        if (cls != NULL) {
+            (*env)->ThrowNew(env, cls, NULL);
+        }
+        return 0;
+    }
+    for (i = 0; i < len; i += n) {
+        n = len - i < chunk ? len - i : chunk;
+        (*env)->GetIntArrayRegion(env, arr, i, n, buf);
+        sum += sumInts(buf, n);
+    }
+    return sum;
+}
+
+/* The original strategy, for comparison: the VM may copy the whole
+   array, and keeps it until the release. */
+JNIEXPORT jlong JNICALL 
+Java_IntArray_sumArrayElements(JNIEnv *env, jobject obj, jintArray arr)
+{
+    jint *carr;
+    jsize len = (*env)->GetArrayLength(env, arr);
+    jlong sum;
     carr = (*env)->GetIntArrayElements(env, arr, NULL);
     if (carr == NULL) {
         return 0; /* exception occurred */
     }
+    sum = sumInts(carr, len);
+    (*env)->ReleaseIntArrayElements(env, arr, carr, JNI_ABORT);
+    return sum;
+}
 
-    for (i=0; i<10; i++) {
-        sum += carr[i];
+JNIEXPORT jint JNICALL 
+Java_IntArray_chunkSize(JNIEnv *env, jclass cls)
+{
+    if (chunkBytes == 0) {
+        chunkBytes = getChunkBytes();
     }
+    return chunkBytes / sizeof(jint);
+}
 
-    (*env)->ReleaseIntArrayElements(env, arr, carr, 0);
+/*
+ * Parallel: the array is pinned once and split across the worker
+ * threads in Parallel.c, which see only the pinned elements.  The GC
+ * waits for the whole sum, as it does for sumArray, but the sum is
+ * done sooner.  The only waiting done while pinned is for those
+ * workers, which never enter the VM; if another thread is using them,
+ * the sum is done on this one.
+ */
+JNIEXPORT jlong JNICALL 
+Java_IntArray_sumArrayParallel(JNIEnv *env, jobject obj, jintArray arr,
+                               jint threads)
+{
+    jint *carr;
+    jsize len = (*env)->GetArrayLength(env, arr);
+    jlong sum;
+    /* Start the workers first, so only the sum is done pinned */
+    parallelThreads();
+    carr = (*env)->GetPrimitiveArrayCritical(env, arr, NULL);
+    if (carr == NULL) {
+        return 0; /* exception occurred */
+    }
+    sum = parallelSumInts(carr, len, threads);
+    (*env)->ReleasePrimitiveArrayCritical(env, arr, carr, JNI_ABORT);
     return sum;
 }
+
+JNIEXPORT jint JNICALL 
+Java_IntArray_parallelThreads(JNIEnv *env, jclass cls)
+{
+    return parallelThreads();
+}
@@ -1,13 +1,37 @@
 class IntArray {
-    private native int sumArray(int[] arr);
+    /* The sums are longs, so they cannot overflow. */
+    native long sumArray(int[] arr);
+    /* The same sum, copied a chunk at a time with no pinning */
+    native long sumArrayChunked(int[] arr);
+    /* The same sum, through GetIntArrayElements */
+    native long sumArrayElements(int[] arr);
+    /* The number of ints sumArrayChunked copies at a time */
+    static native int chunkSize();
+    /* The same sum on up to threads native threads; 0 for all cores */
+    native long sumArrayParallel(int[] arr, int threads);
+    /* The most threads sumArrayParallel will use */
+    static native int parallelThreads();
+    /* Integer.MAX_VALUE and Integer.MIN_VALUE for an empty array */
+    private native int minArray(int[] arr);
+    private native int maxArray(int[] arr);
+    /* Exact while below 2^63, e.g. for any array of values below 2^15 */
+    private native long sumOfSquares(int[] arr);
+    /* The instruction set the native code uses */
+    static native String kernels();
+
     public static void main(String[] args) {
         IntArray p = new IntArray();
-        int arr[] = new int[10];
-        for (int i = 0; i < 10; i++) {
+        int n = args.length > 0 ? Integer.parseInt(args[0]) : 10;
+        int arr[] = new int[n];
+        for (int i = 0; i < n; i++) {
             arr[i] = i;
         }
-        int sum = p.sumArray(arr);
-        System.out.println("sum = " + sum);
+        System.out.println("kernels = " + kernels());
+        System.out.println("sum = " + p.sumArray(arr));
+        System.out.println("parallel sum = " + p.sumArrayParallel(arr, 0));
+        System.out.println("min = " + p.minArray(arr));
+        System.out.println("max = " + p.maxArray(arr));
+        System.out.println("sum of squares = " + p.sumOfSquares(arr));
     }
 
     static {
@@ -0,0 +1,97 @@
+/**
+ * Compares the ways IntArray can get at the elements of an int[] by
+ * array size: a chunk at a time through GetIntArrayRegion, all at once
+ * through GetIntArrayElements, and pinned through
+ * GetPrimitiveArrayCritical.  All three reduce with the same kernels.
+ * <p>
+ * Each line gives the array length, then nanoseconds per element for
+ * each strategy.  The chunked strategy also bounds what the others do
+ * not: it never holds more than one chunk of extra memory, and never
+ * keeps the GC waiting for longer than one chunk takes to copy.
+ * <p>
+ * A second table gives, for the largest array, nanoseconds per element
+ * and speedup of the parallel sum on 1 to all cores.
+ */
+class IntArrayBench {
+
+    /**
+     * @param args optional largest array length, as a power of two
+     *             (default 26, a 256 MB array)
+     */
+    public static void main(String[] args) {
+        int maxLog = args.length > 0 ? Integer.parseInt(args[0]) : 26;
+        IntArray p = new IntArray();
+        int[] arr = null;
+
+        System.out.println("kernels " + IntArray.kernels() + ", chunk " +
+                           IntArray.chunkSize() + " ints");
+        System.out.println("length\t\tchunked ns\telements ns\tcritical ns");
+        for (int log = 10; log <= maxLog; log += 2) {
+            arr = new int[1 << log];
+            for (int i = 0; i < arr.length; i++) {
+                arr[i] = i * 31 - 7;
+            }
+            /* Aim for about 2^28 elements per timing. */
+            int reps = Math.max(1, (1 << 28) >> log);
+            long sum = p.sumArray(arr);
+            if (p.sumArrayChunked(arr) != sum ||
+                p.sumArrayElements(arr) != sum) {
+                throw new RuntimeException("sums differ at " + arr.length);
+            }
+
+            /* Warm up, then time each strategy. */
+            for (int s = 0; s < 3; s++) {
+                time(p, s, arr, Math.max(1, reps / 10));
+            }
+            double n = (double)reps * arr.length;
+            System.out.println(arr.length + "\t" +
+                               (arr.length < 10000000 ? "\t" : "") +
+                               format(time(p, 0, arr, reps) / n) + "\t\t" +
+                               format(time(p, 1, arr, reps) / n) + "\t\t" +
+                               format(time(p, 2, arr, reps) / n));
+        }
+
+        System.out.println();
+        System.out.println("threads\tparallel ns\tspeedup");
+        int reps = Math.max(1, (1 << 28) / arr.length);
+        double n = (double)reps * arr.length;
+        double base = 0;
+        for (int t = 1; t <= IntArray.parallelThreads(); t++) {
+            if (p.sumArrayParallel(arr, t) != p.sumArray(arr)) {
+                throw new RuntimeException("sums differ on " + t);
+            }
+            timeParallel(p, t, arr, Math.max(1, reps / 10));
+            double ns = timeParallel(p, t, arr, reps) / n;
+            if (t == 1) {
+                base = ns;
+            }
+            System.out.println(t + "\t" + format(ns) + "\t\t" +
+                               format(base / ns));
+        }
+    }
+
+    private static long timeParallel(IntArray p, int threads, int[] arr,
+                                     int reps) {
+        long start = System.nanoTime();
+        for (int i = 0; i < reps; i++) {
+            p.sumArrayParallel(arr, threads);
+        }
+        return System.nanoTime() - start;
+    }
+
+    private static long time(IntArray p, int strategy, int[] arr, int reps) {
+        long start = System.nanoTime();
+        for (int i = 0; i < reps; i++) {
+            switch (strategy) {
+            case 0: p.sumArrayChunked(arr); break;
+            case 1: p.sumArrayElements(arr); break;
+            default: p.sumArray(arr); break;
+            }
+        }
+        return System.nanoTime() - start;
+    }
+
+    private static String format(double ns) {
+        return String.valueOf(Math.round(ns * 1000) / 1000.0);
+    }
+}
@@ -0,0 +1,168 @@
+#include <jni.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "Parallel.h"
+#include "Reduce.h"
+
+/* Slices smaller than this cost more to hand out than they save */
+#define MIN_SLICE (64 * 1024)
+#define MAX_THREADS 256
+
+#ifdef _WIN32
+
+jlong
+parallelSumInts(const jint *a, jsize n, int threads)
+{
+    return sumInts(a, n);
+}
+
+int
+parallelThreads(void)
+{
+    return 1;
+}
+
+#else
+
+/* One partial sum per slice, each on its own cache line */
+#define CACHE_LINE 64
+typedef struct {
+    jlong sum;
+    char pad[CACHE_LINE - sizeof(jlong)];
+} partial_t;
+
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static int poolSize;            /* workers started, not counting callers */
+
+/* The current job, guarded by poolLock.  Each job gets a new
+   generation, which is how workers tell it from the last one. */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+static unsigned long generation;
+static const jint *jobArray;
+static jsize jobLength;
+static int jobSlices;
+static int pending;             /* slices not yet summed */
+static partial_t *partials;     /* in partialsBuf, line aligned */
+static char partialsBuf[(MAX_THREADS + 1) * CACHE_LINE];
+
+/* Only one job at a time; held for the whole of a call */
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Sums slice k of the current job into partials[k] */
+static void
+sumSlice(int k)
+{
+    jsize start = (jsize)((jlong)jobLength * k / jobSlices);
+    jsize end = (jsize)((jlong)jobLength * (k + 1) / jobSlices);
+    partials[k].sum = sumInts(jobArray + start, end - start);
+}
+
+static void *
+worker(void *arg)
+{
+    int k = (int)(size_t)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&poolLock);
+    for (;;) {
+        while (generation == seen) {
+            pthread_cond_wait(&jobReady, &poolLock);
+        }
+        seen = generation;
+        if (k >= jobSlices) {
+            continue; /* not needed this time */
+        }
+        pthread_mutex_unlock(&poolLock);
+        sumSlice(k);
+        pthread_mutex_lock(&poolLock);
+        if (--pending == 0) {
+            pthread_cond_signal(&jobDone);
+        }
+    }
+    return NULL;
+}
+
+static void
+startPool(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_attr_t attr;
+    pthread_t tid;
+    int k;
+
+    if (cores > MAX_THREADS) {
+        cores = MAX_THREADS;
+    }
+    partials = (partial_t *)(((size_t)partialsBuf + CACHE_LINE - 1) &
+                             ~(size_t)(CACHE_LINE - 1));
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    /* Worker k sums slice k; the caller always sums slice 0 */
+    for (k = 1; k < cores; k++) {
+        if (pthread_create(&tid, &attr, worker, (void *)(size_t)k) != 0) {
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    poolSize = k - 1 > 0 ? k - 1 : 0;
+}
+
+int
+parallelThreads(void)
+{
+    pthread_once(&poolOnce, startPool);
+    return poolSize + 1;
+}
+
+jlong
+parallelSumInts(const jint *a, jsize n, int threads)
+{
+    jlong sum = 0;
+    int k, max = parallelThreads();
+
+    if (threads <= 0 || threads > max) {
+        threads = max;
+    }
+    if (threads > n / MIN_SLICE) {
+        threads = n / MIN_SLICE;
+    }
+    if (threads <= 1) {
+        return sumInts(a, n);
+    }
+
+    /* The lock is held by another Java thread, which may stay in its
+       critical region for as long as it likes; don't wait for it in
+       ours.  The workers, which are waited for below, never enter the
+       VM. */
+    if (pthread_mutex_trylock(&jobLock) != 0) {
+        return sumInts(a, n);
+    }
+    pthread_mutex_lock(&poolLock);
+    jobArray = a;
+    jobLength = n;
+    jobSlices = threads;
+    pending = threads - 1;
+    generation++;
+    pthread_cond_broadcast(&jobReady);
+    pthread_mutex_unlock(&poolLock);
+
+    sumSlice(0);
+
+    pthread_mutex_lock(&poolLock);
+    while (pending > 0) {
+        pthread_cond_wait(&jobDone, &poolLock);
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    for (k = 0; k < threads; k++) {
+        sum += partials[k].sum;
+    }
+    pthread_mutex_unlock(&jobLock);
+    return sum;
+}
+
+#endif /* _WIN32 */
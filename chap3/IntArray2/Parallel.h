@@ -0,0 +1,24 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <jni.h>
+
+/*
+ * Sums in parallel on a pool of native worker threads, one per core,
+ * started on first use.  The calling thread takes a slice itself and
+ * waits for the rest, so a call returns the complete sum.  Workers only
+ * ever see C memory: the caller pins the array and never passes its
+ * JNIEnv on.  Only one call at a time uses the pool; a call made while
+ * another is running sums serially instead of waiting, so a caller may
+ * hold an array pinned with GetPrimitiveArrayCritical.
+ *
+ * threads is how many threads, the caller included, to use; 0 or less
+ * means all of them.  Fewer are used for arrays too small to be worth
+ * splitting that far.  On Win32 the sum is always computed serially.
+ */
+jlong parallelSumInts(const jint *a, jsize n, int threads);
+
+/* How many threads parallelSumInts can use, the caller included */
+int parallelThreads(void);
+
+#endif /* _PARALLEL_H_ */
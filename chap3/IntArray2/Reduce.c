@@ -0,0 +1,354 @@
+#include <jni.h>
+#include "Reduce.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define REDUCE_X86
+#define TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define REDUCE_X86
+#define TARGET(isa)
+#endif
+
+#define JINT_MAX ((jint)0x7fffffff)
+#define JINT_MIN ((jint)-0x7fffffff - 1)
+
+/* One set of kernels per instruction set */
+typedef struct {
+    const char *name;
+    jlong (*sum)(const jint *a, jsize n);
+    jint (*min)(const jint *a, jsize n);
+    jint (*max)(const jint *a, jsize n);
+    jlong (*sumSquares)(const jint *a, jsize n);
+} kernels_t;
+
+/*
+ * Plain C, also used for the tails the vector loops leave over.
+ */
+
+static jlong
+sumC(const jint *a, jsize n)
+{
+    jlong sum = 0;
+    jsize i;
+    for (i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+static jint
+minC(const jint *a, jsize n)
+{
+    jint m = JINT_MAX;
+    jsize i;
+    for (i = 0; i < n; i++) {
+        if (a[i] < m) m = a[i];
+    }
+    return m;
+}
+
+static jint
+maxC(const jint *a, jsize n)
+{
+    jint m = JINT_MIN;
+    jsize i;
+    for (i = 0; i < n; i++) {
+        if (a[i] > m) m = a[i];
+    }
+    return m;
+}
+
+static jlong
+sumSquaresC(const jint *a, jsize n)
+{
+    jlong sum = 0;
+    jsize i;
+    for (i = 0; i < n; i++) {
+        sum += (jlong)a[i] * a[i];
+    }
+    return sum;
+}
+
+static const kernels_t cKernels = {
+    "c", sumC, minC, maxC, sumSquaresC
+};
+
+#ifdef REDUCE_X86
+
+/*
+ * SSE4.1: 4 ints per vector.  Sums widen each int to 64 bits
+ * (pmovsxdq) before adding; squares use the signed 32x32->64 bit
+ * multiply (pmuldq).
+ */
+
+static TARGET("sse4.1") jlong
+hsum128(__m128i v)
+{
+    jlong lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+static TARGET("sse4.1") jlong
+sumSSE41(const jint *a, jsize n)
+{
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    jsize i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(a + i));
+        acc0 = _mm_add_epi64(acc0, _mm_cvtepi32_epi64(v));
+        acc1 = _mm_add_epi64(acc1,
+                             _mm_cvtepi32_epi64(_mm_srli_si128(v, 8)));
+    }
+    return hsum128(_mm_add_epi64(acc0, acc1)) + sumC(a + i, n - i);
+}
+
+static TARGET("sse4.1") jint
+minSSE41(const jint *a, jsize n)
+{
+    __m128i acc = _mm_set1_epi32(JINT_MAX);
+    jint lanes[4], m, t;
+    jsize i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        acc = _mm_min_epi32(acc,
+                            _mm_loadu_si128((const __m128i *)(a + i)));
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    m = minC(lanes, 4);
+    t = minC(a + i, n - i);
+    return t < m ? t : m;
+}
+
+static TARGET("sse4.1") jint
+maxSSE41(const jint *a, jsize n)
+{
+    __m128i acc = _mm_set1_epi32(JINT_MIN);
+    jint lanes[4], m, t;
+    jsize i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        acc = _mm_max_epi32(acc,
+                            _mm_loadu_si128((const __m128i *)(a + i)));
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    m = maxC(lanes, 4);
+    t = maxC(a + i, n - i);
+    return t > m ? t : m;
+}
+
+static TARGET("sse4.1") jlong
+sumSquaresSSE41(const jint *a, jsize n)
+{
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    jsize i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i lo = _mm_cvtepi32_epi64(v);
+        __m128i hi = _mm_cvtepi32_epi64(_mm_srli_si128(v, 8));
+        acc0 = _mm_add_epi64(acc0, _mm_mul_epi32(lo, lo));
+        acc1 = _mm_add_epi64(acc1, _mm_mul_epi32(hi, hi));
+    }
+    return hsum128(_mm_add_epi64(acc0, acc1)) + sumSquaresC(a + i, n - i);
+}
+
+static const kernels_t sse41Kernels = {
+    "sse4.1", sumSSE41, minSSE41, maxSSE41, sumSquaresSSE41
+};
+
+/*
+ * AVX2: the same, 8 ints per vector, 16 per iteration spread over
+ * independent accumulators so that each add need not wait for the
+ * one before.
+ */
+
+static TARGET("avx2") jlong
+hsum256(__m256i v)
+{
+    jlong lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static TARGET("avx2") jlong
+sumAVX2(const jint *a, jsize n)
+{
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+    jsize i;
+
+#define WIDEN(k) \
+    _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(a + i + (k))))
+    for (i = 0; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_epi64(acc0, WIDEN(0));
+        acc1 = _mm256_add_epi64(acc1, WIDEN(4));
+        acc2 = _mm256_add_epi64(acc2, WIDEN(8));
+        acc3 = _mm256_add_epi64(acc3, WIDEN(12));
+    }
+    acc0 = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1),
+                            _mm256_add_epi64(acc2, acc3));
+    return hsum256(acc0) + sumC(a + i, n - i);
+}
+
+static TARGET("avx2") jint
+minAVX2(const jint *a, jsize n)
+{
+    __m256i acc0 = _mm256_set1_epi32(JINT_MAX), acc1 = acc0;
+    jint lanes[8], m, t;
+    jsize i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        acc0 = _mm256_min_epi32(acc0,
+            _mm256_loadu_si256((const __m256i *)(a + i)));
+        acc1 = _mm256_min_epi32(acc1,
+            _mm256_loadu_si256((const __m256i *)(a + i + 8)));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_min_epi32(acc0, acc1));
+    m = minC(lanes, 8);
+    t = minC(a + i, n - i);
+    return t < m ? t : m;
+}
+
+static TARGET("avx2") jint
+maxAVX2(const jint *a, jsize n)
+{
+    __m256i acc0 = _mm256_set1_epi32(JINT_MIN), acc1 = acc0;
+    jint lanes[8], m, t;
+    jsize i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        acc0 = _mm256_max_epi32(acc0,
+            _mm256_loadu_si256((const __m256i *)(a + i)));
+        acc1 = _mm256_max_epi32(acc1,
+            _mm256_loadu_si256((const __m256i *)(a + i + 8)));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_max_epi32(acc0, acc1));
+    m = maxC(lanes, 8);
+    t = maxC(a + i, n - i);
+    return t > m ? t : m;
+}
+
+static TARGET("avx2") jlong
+sumSquaresAVX2(const jint *a, jsize n)
+{
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+    __m256i w;
+    jsize i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        w = WIDEN(0);
+        acc0 = _mm256_add_epi64(acc0, _mm256_mul_epi32(w, w));
+        w = WIDEN(4);
+        acc1 = _mm256_add_epi64(acc1, _mm256_mul_epi32(w, w));
+        w = WIDEN(8);
+        acc2 = _mm256_add_epi64(acc2, _mm256_mul_epi32(w, w));
+        w = WIDEN(12);
+        acc3 = _mm256_add_epi64(acc3, _mm256_mul_epi32(w, w));
+    }
+#undef WIDEN
+    acc0 = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1),
+                            _mm256_add_epi64(acc2, acc3));
+    return hsum256(acc0) + sumSquaresC(a + i, n - i);
+}
+
+static const kernels_t avx2Kernels = {
+    "avx2", sumAVX2, minAVX2, maxAVX2, sumSquaresAVX2
+};
+
+/* Can the CPU, and the OS, run AVX2 or SSE4.1 code? */
+#ifdef _MSC_VER
+static int
+hasAVX2(void)
+{
+    int info[4];
+    __cpuid(info, 1);
+    /* OSXSAVE and AVX, and the OS saves the YMM registers */
+    if ((info[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28) ||
+        (_xgetbv(0) & 6) != 6) {
+        return 0;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+static int
+hasSSE41(void)
+{
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+}
+#else
+static int
+hasAVX2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static int
+hasSSE41(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#endif /* REDUCE_X86 */
+
+/* Chosen on first use.  Threads racing to set it store the same value. */
+static const kernels_t *kernels;
+
+static const kernels_t *
+getKernels(void)
+{
+    const kernels_t *k = kernels;
+    if (k == NULL) {
+        k = &cKernels;
+#ifdef REDUCE_X86
+        if (hasAVX2()) {
+            k = &avx2Kernels;
+        } else if (hasSSE41()) {
+            k = &sse41Kernels;
+        }
+#endif
+        kernels = k;
+    }
+    return k;
+}
+
+jlong
+sumInts(const jint *a, jsize n)
+{
+    return getKernels()->sum(a, n);
+}
+
+jint
+minInts(const jint *a, jsize n)
+{
+    return getKernels()->min(a, n);
+}
+
+jint
+maxInts(const jint *a, jsize n)
+{
+    return getKernels()->max(a, n);
+}
+
+jlong
+sumSquaresInts(const jint *a, jsize n)
+{
+    return getKernels()->sumSquares(a, n);
+}
+
+const char *
+reduceKernels(void)
+{
+    return getKernels()->name;
+}
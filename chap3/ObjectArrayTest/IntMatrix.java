@@ -0,0 +1,58 @@
+/**
+ * A matrix of ints held row after row in a single <code>int[]</code>,
+ * as an alternative to an <code>int[][]</code>.  The whole matrix is
+ * one object in contiguous memory, so walking it row by row is cache
+ * friendly, and native code can reach all of it through one array.
+ * The element at row <code>i</code>, column <code>j</code> is
+ * <code>data[i * cols + j]</code>.
+ */
+class IntMatrix {
+    final int rows;
+    final int cols;
+    final int[] data;
+
+    IntMatrix(int rows, int cols) {
+        if (rows < 0 || cols < 0 || (long)rows * cols > Integer.MAX_VALUE) {
+            throw new IllegalArgumentException(rows + " x " + cols);
+        }
+        this.rows = rows;
+        this.cols = cols;
+        this.data = new int[rows * cols];
+    }
+
+    int get(int i, int j) {
+        return data[i * cols + j];
+    }
+
+    void set(int i, int j, int value) {
+        data[i * cols + j] = value;
+    }
+
+    /**
+     * Copies a rectangular <code>int[][]</code>, one
+     * <code>System.arraycopy</code> per row.
+     *
+     * @throws IllegalArgumentException if the rows differ in length
+     */
+    static IntMatrix fromJagged(int[][] a) {
+        int cols = a.length > 0 ? a[0].length : 0;
+        IntMatrix m = new IntMatrix(a.length, cols);
+        for (int i = 0; i < a.length; i++) {
+            if (a[i].length != cols) {
+                throw new IllegalArgumentException("row " + i + " has " +
+                                                   a[i].length + " columns");
+            }
+            System.arraycopy(a[i], 0, m.data, i * cols, cols);
+        }
+        return m;
+    }
+
+    /** Copies the matrix to a new <code>int[][]</code>. */
+    int[][] toJagged() {
+        int[][] a = new int[rows][cols];
+        for (int i = 0; i < rows; i++) {
+            System.arraycopy(data, i * cols, a[i], 0, cols);
+        }
+        return a;
+    }
+}
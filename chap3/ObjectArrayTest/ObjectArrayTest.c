@@ -1,6 +1,53 @@
 #include <jni.h>
 #include <stdio.h>
+#include <stdlib.h>
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FILL_SSE2
+#endif
 #include "ObjectArrayTest.h"
+
+/* Stores first, first + 1, ... in the n ints at row */
+static void
+fillRow(jint *row, jint first, jsize n)
+{
+    jsize j = 0;
+#ifdef FILL_SSE2
+    __m128i v = _mm_add_epi32(_mm_set1_epi32(first),
+                              _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i four = _mm_set1_epi32(4);
+    for (; j + 8 <= n; j += 8) {
+        _mm_storeu_si128((__m128i *)(row + j), v);
+        v = _mm_add_epi32(v, four);
+        _mm_storeu_si128((__m128i *)(row + j + 4), v);
+        v = _mm_add_epi32(v, four);
+    }
+#endif
+    for (; j < n; j++) {
+        row[j] = first + j;
+    }
+}
+
+/* Stores i + j at row i, column j of a flat, row-major matrix */
+static void
+fillMatrix(jint *m, jint rows, jint cols)
+{
+    jint i;
+    for (i = 0; i < rows; i++) {
+        fillRow(m + (size_t)i * cols, i, cols);
+    }
+}
+
+static void
+throwByName(JNIEnv *env, const char *name, const char *msg)
+{
+    jclass cls = (*env)->FindClass(env, name);
+    if (cls != NULL) {
+        (*env)->ThrowNew(env, cls, msg);
+    }
+    (*env)->DeleteLocalRef(env, cls);
+}
 
 JNIEXPORT jobjectArray JNICALL
 Java_ObjectArrayTest_initInt2DArray(JNIEnv *env,
@@ -8,6 +55,7 @@ Java_ObjectArrayTest_initInt2DArray(JNIEnv *env,
                                    jint size)
 {
     jobjectArray result;
+    jint *tmp;
     int i;
     jclass intArrCls = (*env)->FindClass(env, "[I");
     if (intArrCls == NULL) {
@@ -17,19 +65,74 @@ Java_ObjectArrayTest_initInt2DArray(JNIEnv *env,
     if (result == NULL) {
         return NULL; /* out of memory error thrown */
     }
+    /* one row buffer, as large as a row, for all rows */
+    tmp = (jint *)malloc((size > 0 ? size : 1) * sizeof(jint));
+    if (tmp == NULL) {
+        throwByName(env, "java/lang/OutOfMemoryError", NULL);
+        return NULL;
+    }
     for (i = 0; i < size; i++) {
-        jint tmp[256];  /* make sure it is large enough! */
-        int j;
         jintArray iarr = (*env)->NewIntArray(env, size);
         if (iarr == NULL) {
+            free(tmp);
             return NULL; /* out of memory error thrown */
         }
-        for (j = 0; j < size; j++) {
-            tmp[j] = i + j;
-        }
+        fillRow(tmp, i, size);
         (*env)->SetIntArrayRegion(env, iarr, 0, size, tmp);
         (*env)->SetObjectArrayElement(env, result, i, iarr);
         (*env)->DeleteLocalRef(env, iarr);
     }
+    free(tmp);
     return result;
 }
+
+/*
+ * The flat alternatives: one int[], or one direct buffer, holds the
+ * whole matrix row after row, and is filled in a single call with no
+ * per-row JNI calls or objects.
+ */
+
+JNIEXPORT void JNICALL
+Java_ObjectArrayTest_initIntMatrix(JNIEnv *env,
+                                   jclass cls,
+                                   jintArray data,
+                                   jint rows,
+                                   jint cols)
+{
+    jint *m;
+    if (rows < 0 || cols < 0 ||
+        (jlong)rows * cols > (*env)->GetArrayLength(env, data)) {
+        throwByName(env, "java/lang/IllegalArgumentException",
+                    "matrix does not fit in the array");
+        return;
+    }
+    m = (*env)->GetPrimitiveArrayCritical(env, data, NULL);
+    if (m == NULL) {
+        return; /* exception thrown */
+    }
+    fillMatrix(m, rows, cols);
+    (*env)->ReleasePrimitiveArrayCritical(env, data, m, 0);
+}
+
+JNIEXPORT void JNICALL
+Java_ObjectArrayTest_initIntBuffer(JNIEnv *env,
+                                   jclass cls,
+                                   jobject buf,
+                                   jint rows,
+                                   jint cols)
+{
+    /* for an IntBuffer, the capacity is in ints */
+    jint *m = (*env)->GetDirectBufferAddress(env, buf);
+    if (m == NULL) {
+        throwByName(env, "java/lang/IllegalArgumentException",
+                    "not a direct buffer");
+        return;
+    }
+    if (rows < 0 || cols < 0 ||
+        (jlong)rows * cols > (*env)->GetDirectBufferCapacity(env, buf)) {
+        throwByName(env, "java/lang/IllegalArgumentException",
+                    "matrix does not fit in the buffer");
+        return;
+    }
+    fillMatrix(m, rows, cols);
+}
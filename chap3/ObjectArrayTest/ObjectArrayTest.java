@@ -1,5 +1,29 @@
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.IntBuffer;
+import java.util.Arrays;
+
 class ObjectArrayTest {
     private static native int[][] initInt2DArray(int size);
+    /* The same values, i + j, in a flat row-major array or buffer */
+    private static native void initIntMatrix(int[] data, int rows, int cols);
+    private static native void initIntBuffer(IntBuffer buf, int rows,
+                                             int cols);
+
+    static IntMatrix newIntMatrix(int rows, int cols) {
+        IntMatrix m = new IntMatrix(rows, cols);
+        initIntMatrix(m.data, rows, cols);
+        return m;
+    }
+
+    /* The buffer must be direct and in native byte order. */
+    static IntBuffer newIntBuffer(int rows, int cols) {
+        IntBuffer buf = ByteBuffer.allocateDirect(rows * cols * 4)
+            .order(ByteOrder.nativeOrder()).asIntBuffer();
+        initIntBuffer(buf, rows, cols);
+        return buf;
+    }
+
     public static void main(String[] args) {
         int[][] i2arr = initInt2DArray(3);
         for (int i = 0; i < 3; i++) {
@@ -8,6 +32,26 @@ class ObjectArrayTest {
             }
             System.out.println();
         }
+
+        IntMatrix m = newIntMatrix(3, 3);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                 System.out.print(" " + m.get(i, j));
+            }
+            System.out.println();
+        }
+
+        /* Larger than the old 256 entry row buffer allowed */
+        int size = args.length > 0 ? Integer.parseInt(args[0]) : 1000;
+        int[][] jagged = initInt2DArray(size);
+        IntMatrix flat = newIntMatrix(size, size);
+        IntBuffer buf = newIntBuffer(size, size);
+        boolean same = Arrays.deepEquals(jagged, flat.toJagged()) &&
+            Arrays.equals(IntMatrix.fromJagged(jagged).data, flat.data);
+        for (int k = 0; same && k < flat.data.length; k++) {
+            same = buf.get(k) == flat.data[k];
+        }
+        System.out.println(size + " x " + size + " forms agree: " + same);
     }
     static {
         System.loadLibrary("ObjectArrayTest");
@@ -1,24 +1,27 @@
 #include <jni.h>
 #include <stdio.h>
 #include "InstanceFieldAccess.h"  
+#include "IDCache.h"
+
+static jfieldID fid_s; /* cached field ID for s */
+
+/* Resolved once, when the library is loaded */
+static JNU_IDEntry ids[] = {
+    { JNU_FIELD, "InstanceFieldAccess", "s", "Ljava/lang/String;", &fid_s },
+};
+
+JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM *jvm, void *reserved)
+{
+    return JNU_LoadIDs(jvm, ids, JNU_NIDS(ids));
+}
 
 JNIEXPORT void JNICALL 
 Java_InstanceFieldAccess_accessField(JNIEnv *env, jobject obj)
 {
-    static jfieldID fid_s = NULL; /* cached field ID for s */
-
-    jclass cls = (*env)->GetObjectClass(env, obj);
     jstring jstr;
     const char *str;
 
-    if (fid_s == NULL) {
-        fid_s = (*env)->GetFieldID(env, cls, "s", 
-                                   "Ljava/lang/String;");
-        if (fid_s == 0) {
-            return; /* exception already thrown */
-        }
-    }
-
     printf("In C:\n");
 
     jstr = (*env)->GetObjectField(env, obj, fid_s);
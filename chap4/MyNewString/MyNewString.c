@@ -1,27 +1,35 @@
 #include <jni.h>
 #include <stdio.h>
 #include "MyNewString.h"
+#include "IDCache.h"
+
+static jclass stringClass;      /* global reference */
+static jmethodID cid;           /* the String(char[]) constructor */
+
+/* Resolved once, when the library is loaded */
+static JNU_IDEntry ids[] = {
+    { JNU_CLASS,  "java/lang/String", 0, 0, &stringClass },
+    { JNU_METHOD, "java/lang/String", "<init>", "([C)V", &cid },
+};
+
+JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM *jvm, void *reserved)
+{
+    return JNU_LoadIDs(jvm, ids, JNU_NIDS(ids));
+}
+
+JNIEXPORT void JNICALL
+JNI_OnUnload(JavaVM *jvm, void *reserved)
+{
+    JNU_UnloadIDs(jvm, ids, JNU_NIDS(ids));
+}
 
 jstring
 MyNewString(JNIEnv *env, jchar *chars, jint len)
 {
-    jclass stringClass;
-    jmethodID cid;
     jcharArray elemArr;
     jstring result;
 
-    stringClass = (*env)->FindClass(env, "java/lang/String");
-    if (stringClass == NULL) {
-        return NULL; /* exception thrown */
-    }
-
-    /* Get the method ID for the String(char[]) constructor */
-    cid = (*env)->GetMethodID(env, stringClass,
-                              "<init>", "([C)V");
-    if (cid == NULL) {
-        return NULL; /* exception thrown */
-    }
-
     /* Create a char[] that holds the string characters */
     elemArr = (*env)->NewCharArray(env, len);
     if (elemArr == NULL) {
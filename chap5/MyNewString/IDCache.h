@@ -0,0 +1,66 @@
+#ifndef _IDCACHE_H_
+#define _IDCACHE_H_
+
+#include <jni.h>
+
+/*
+ * A table of the classes, method IDs and field IDs a library uses,
+ * resolved all at once in JNI_OnLoad so that native methods never look
+ * them up themselves.  Each entry names a class and, except for class
+ * entries, a member, and says where to store the result:
+ *
+ *     static jclass Class_String;
+ *     static jmethodID MID_String_init;
+ *
+ *     static JNU_IDEntry ids[] = {
+ *         { JNU_CLASS,  "java/lang/String", 0, 0, &Class_String },
+ *         { JNU_METHOD, "java/lang/String", "<init>", "([C)V",
+ *           &MID_String_init },
+ *     };
+ *
+ *     JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *jvm, void *reserved)
+ *     {
+ *         return JNU_LoadIDs(jvm, ids, JNU_NIDS(ids));
+ *     }
+ *
+ * Classes are held through global references, or weak global
+ * references so as not to keep the class from being unloaded.
+ */
+typedef enum {
+    JNU_CLASS,                  /* jclass, global reference */
+    JNU_WEAK_CLASS,             /* jclass, weak global reference */
+    JNU_METHOD,                 /* jmethodID */
+    JNU_STATIC_METHOD,          /* jmethodID */
+    JNU_FIELD,                  /* jfieldID */
+    JNU_STATIC_FIELD            /* jfieldID */
+} JNU_IDKind;
+
+typedef struct {
+    JNU_IDKind kind;
+    const char *cls;            /* class name, e.g. "java/lang/String" */
+    const char *name;           /* member name; 0 for classes */
+    const char *sig;            /* member descriptor; 0 for classes */
+    void *id;                   /* a jclass, jmethodID or jfieldID */
+} JNU_IDEntry;
+
+#define JNU_NIDS(table) ((int)(sizeof(table) / sizeof((table)[0])))
+
+/*
+ * Resolve every entry of a table.  Stops at the first entry that
+ * cannot be resolved, reports it on stderr and returns JNI_ERR, with
+ * no exception pending; otherwise returns JNI_OK.
+ */
+jint JNU_ResolveIDs(JNIEnv *env, JNU_IDEntry *table, int n);
+
+/* Delete the class references made by JNU_ResolveIDs */
+void JNU_ReleaseIDs(JNIEnv *env, JNU_IDEntry *table, int n);
+
+/*
+ * JNI_OnLoad and JNI_OnUnload in one call each.  JNU_LoadIDs returns
+ * the JNI version to return from JNI_OnLoad, or JNI_ERR, which makes
+ * System.loadLibrary fail.
+ */
+jint JNU_LoadIDs(JavaVM *jvm, JNU_IDEntry *table, int n);
+void JNU_UnloadIDs(JavaVM *jvm, JNU_IDEntry *table, int n);
+
+#endif /* _IDCACHE_H_ */
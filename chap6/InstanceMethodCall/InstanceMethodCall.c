@@ -1,7 +1,21 @@
 #include <jni.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "InstanceMethodCall.h"
 
+#ifdef SOLARIS2
+#include <atomic.h>
+#define CAS_PTR(p, old, new) (atomic_cas_ptr(p, old, new) == (old))
+#elif defined(WIN32)
+#include <windows.h>
+#define CAS_PTR(p, old, new) \
+    (InterlockedCompareExchangePointer((PVOID volatile *)(p), new, old) == \
+     (old))
+#else
+#define CAS_PTR(p, old, new) __sync_bool_compare_and_swap(p, old, new)
+#endif
+
 jvalue
 JNU_CallMethodByName(JNIEnv *env,
                      jboolean *hasException,
@@ -80,9 +94,210 @@ JNU_CallMethodByName(JNIEnv *env,
     return result;
 }
 
+/*
+ * A resolved method, cached by JNU_CallMethodByNameCached.  Entries
+ * are published into a fixed table with compare-and-swap and read
+ * without locking.  The class is held through a weak global reference,
+ * so caching a method does not keep its class from being unloaded; an
+ * entry whose class has gone is dead, and its table slot is reused.
+ * Entries are never freed, since another thread may still be reading
+ * one that has been replaced.
+ */
+typedef struct {
+    jweak clazz;
+    jmethodID mid;
+    char kind;                  /* return type: V Z B C S I J F D or L */
+    unsigned int hash;
+    char *name;                 /* points into key */
+    char key[1];                /* "descriptor\0name\0" */
+} method_entry;
+
+#define METHOD_SLOTS 256        /* a power of two */
+#define METHOD_PROBES 8         /* slots tried before giving up */
+
+static method_entry * volatile method_table[METHOD_SLOTS];
+
+static unsigned int
+method_hash(const char *name, const char *descriptor)
+{
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    while (*descriptor) {
+        h = (h ^ (unsigned char)*descriptor++) * 16777619u;
+    }
+    return h;
+}
+
+/* Resolve a method and make a cache entry for it, or return NULL */
+static method_entry *
+method_resolve(JNIEnv *env, jclass clazz, const char *name,
+               const char *descriptor, unsigned int hash)
+{
+    size_t dlen = strlen(descriptor);
+    method_entry *e;
+    jmethodID mid;
+    const char *p;
+
+    mid = (*env)->GetMethodID(env, clazz, name, descriptor);
+    if (mid == NULL) {
+        return NULL;
+    }
+    e = (method_entry *)malloc(sizeof(method_entry) + dlen +
+                               strlen(name) + 1);
+    if (e == NULL) {
+        jclass oom = (*env)->FindClass(env, "java/lang/OutOfMemoryError");
+        if (oom != NULL) {
+            (*env)->ThrowNew(env, oom, "method cache");
+        }
+        return NULL;
+    }
+    e->clazz = (*env)->NewWeakGlobalRef(env, clazz);
+    if (e->clazz == NULL) {
+        free(e);
+        return NULL;
+    }
+    e->mid = mid;
+    /* the return type follows the ')' */
+    p = strchr(descriptor, ')') + 1;
+    e->kind = *p == '[' ? 'L' : *p;
+    e->hash = hash;
+    strcpy(e->key, descriptor);
+    e->name = e->key + dlen + 1;
+    strcpy(e->name, name);
+    return e;
+}
+
+/* Call a method whose return type is given by kind */
+static jvalue
+call_method_v(JNIEnv *env, jobject obj, jmethodID mid, char kind,
+              va_list args)
+{
+    jvalue result;
+
+    result.j = 0;
+    switch (kind) {
+    case 'V':
+        (*env)->CallVoidMethodV(env, obj, mid, args);
+        break;
+    case 'L':
+        result.l = (*env)->CallObjectMethodV(env, obj, mid, args);
+        break;
+    case 'Z':
+        result.z = (*env)->CallBooleanMethodV(env, obj, mid, args);
+        break;
+    case 'B':
+        result.b = (*env)->CallByteMethodV(env, obj, mid, args);
+        break;
+    case 'C':
+        result.c = (*env)->CallCharMethodV(env, obj, mid, args);
+        break;
+    case 'S':
+        result.s = (*env)->CallShortMethodV(env, obj, mid, args);
+        break;
+    case 'I':
+        result.i = (*env)->CallIntMethodV(env, obj, mid, args);
+        break;
+    case 'J':
+        result.j = (*env)->CallLongMethodV(env, obj, mid, args);
+        break;
+    case 'F':
+        result.f = (*env)->CallFloatMethodV(env, obj, mid, args);
+        break;
+    case 'D':
+        result.d = (*env)->CallDoubleMethodV(env, obj, mid, args);
+        break;
+    default:
+        (*env)->FatalError(env, "illegal descriptor");
+    }
+    return result;
+}
+
+/*
+ * Like JNU_CallMethodByName, but the method ID and return type are
+ * looked up only on the first call for a given class, name and
+ * descriptor.  Later calls cost a hash probe, GetObjectClass and
+ * IsSameObject on top of the upcall itself.  If the table is full the
+ * method is looked up every time, as JNU_CallMethodByName does.
+ */
+jvalue
+JNU_CallMethodByNameCached(JNIEnv *env,
+                           jboolean *hasException,
+                           jobject obj,
+                           const char *name,
+                           const char *descriptor,
+                           ...)
+{
+    va_list args;
+    jclass clazz;
+    jvalue result;
+    method_entry *e = NULL, *fresh = NULL;
+    unsigned int hash = method_hash(name, descriptor);
+    int i;
+
+    result.j = 0;
+    if ((*env)->EnsureLocalCapacity(env, 2) != JNI_OK) {
+        goto done;
+    }
+    clazz = (*env)->GetObjectClass(env, obj);
+
+    for (i = 0; i < METHOD_PROBES; i++) {
+        method_entry * volatile *slot =
+            &method_table[(hash + i) & (METHOD_SLOTS - 1)];
+        method_entry *old = *slot;
+        if (old == NULL || (*env)->IsSameObject(env, old->clazz, NULL)) {
+            /* free, or its class is unloaded: claim it */
+            if (fresh == NULL &&
+                (fresh = method_resolve(env, clazz, name, descriptor,
+                                        hash)) == NULL) {
+                break;
+            }
+            if (CAS_PTR(slot, old, fresh)) {
+                e = fresh;
+                fresh = NULL;
+                break;
+            }
+            old = *slot;        /* lost the race; look at the winner */
+        }
+        if (old->hash == hash &&
+            (*env)->IsSameObject(env, old->clazz, clazz) &&
+            strcmp(old->key, descriptor) == 0 &&
+            strcmp(old->name, name) == 0) {
+            e = old;
+            break;
+        }
+    }
+    if (e == NULL) {
+        if (fresh == NULL && !(*env)->ExceptionCheck(env)) {
+            /* no slot near this hash: call it uncached */
+            fresh = method_resolve(env, clazz, name, descriptor, hash);
+        }
+        e = fresh;
+    }
+    if (e != NULL) {
+        va_start(args, descriptor);
+        result = call_method_v(env, obj, e->mid, e->kind, args);
+        va_end(args);
+    }
+    if (fresh != NULL) {
+        /* resolved, but never published */
+        (*env)->DeleteWeakGlobalRef(env, fresh->clazz);
+        free(fresh);
+    }
+    (*env)->DeleteLocalRef(env, clazz);
+
+done:
+    if (hasException) {
+        *hasException = (*env)->ExceptionCheck(env);
+    }
+    return result;
+}
+
 JNIEXPORT void JNICALL 
 Java_InstanceMethodCall_nativeMethod(JNIEnv *env, jobject obj)
 {
     printf("In C\n");
-    JNU_CallMethodByName(env, NULL, obj, "callback", "()V");
+    /* the same as JNU_CallMethodByName, after the first call */
+    JNU_CallMethodByNameCached(env, NULL, obj, "callback", "()V");
 }
@@ -0,0 +1,104 @@
+#include <jni.h>
+#include <stdio.h>
+#include "IDCache.h"
+
+jint
+JNU_ResolveIDs(JNIEnv *env, JNU_IDEntry *table, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        JNU_IDEntry *e = &table[i];
+        jclass cls = (*env)->FindClass(env, e->cls);
+        void *id = NULL;
+
+        if (cls != NULL) {
+            switch (e->kind) {
+            case JNU_CLASS:
+                id = (*env)->NewGlobalRef(env, cls);
+                break;
+            case JNU_WEAK_CLASS:
+                id = (*env)->NewWeakGlobalRef(env, cls);
+                break;
+            case JNU_METHOD:
+                id = (*env)->GetMethodID(env, cls, e->name, e->sig);
+                break;
+            case JNU_STATIC_METHOD:
+                id = (*env)->GetStaticMethodID(env, cls, e->name, e->sig);
+                break;
+            case JNU_FIELD:
+                id = (*env)->GetFieldID(env, cls, e->name, e->sig);
+                break;
+            case JNU_STATIC_FIELD:
+                id = (*env)->GetStaticFieldID(env, cls, e->name, e->sig);
+                break;
+            }
+            (*env)->DeleteLocalRef(env, cls);
+        }
+        if (id == NULL) {
+            /* the library will not load; say exactly why */
+            (*env)->ExceptionClear(env);
+            fprintf(stderr, "cannot resolve %s%s%s%s\n", e->cls,
+                    e->name ? "." : "", e->name ? e->name : "",
+                    e->sig ? e->sig : "");
+            JNU_ReleaseIDs(env, table, i);
+            return JNI_ERR;
+        }
+        switch (e->kind) {
+        case JNU_CLASS:
+        case JNU_WEAK_CLASS:
+            *(jclass *)e->id = (jclass)id;
+            break;
+        case JNU_METHOD:
+        case JNU_STATIC_METHOD:
+            *(jmethodID *)e->id = (jmethodID)id;
+            break;
+        default:
+            *(jfieldID *)e->id = (jfieldID)id;
+            break;
+        }
+    }
+    return JNI_OK;
+}
+
+void
+JNU_ReleaseIDs(JNIEnv *env, JNU_IDEntry *table, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        jclass *clsP = (jclass *)table[i].id;
+        if (table[i].kind == JNU_CLASS && *clsP != NULL) {
+            (*env)->DeleteGlobalRef(env, *clsP);
+            *clsP = NULL;
+        } else if (table[i].kind == JNU_WEAK_CLASS && *clsP != NULL) {
+            (*env)->DeleteWeakGlobalRef(env, *clsP);
+            *clsP = NULL;
+        }
+    }
+}
+
+jint
+JNU_LoadIDs(JavaVM *jvm, JNU_IDEntry *table, int n)
+{
+    JNIEnv *env;
+
+    if ((*jvm)->GetEnv(jvm, (void **)&env, JNI_VERSION_1_2)) {
+        return JNI_ERR;
+    }
+    if (JNU_ResolveIDs(env, table, n) != JNI_OK) {
+        return JNI_ERR;
+    }
+    return JNI_VERSION_1_2;
+}
+
+void
+JNU_UnloadIDs(JavaVM *jvm, JNU_IDEntry *table, int n)
+{
+    JNIEnv *env;
+
+    if ((*jvm)->GetEnv(jvm, (void **)&env, JNI_VERSION_1_2)) {
+        return;
+    }
+    JNU_ReleaseIDs(env, table, n);
+}
@@ -0,0 +1,650 @@
+#include <jni.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <iconv.h>
+#include <langinfo.h>
+#include <pthread.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NC_SSE2
+#endif
+#include "NativeChars.h"
+#include "IDCache.h"
+
+extern void JNU_ThrowByName(JNIEnv *env, const char *name, const char *msg);
+
+/* How strings are converted, set up by JNU_InitNativeChars.  Every
+ * encoding but NC_OTHER is ASCII compatible.
+ */
+static enum {
+    NC_OTHER,                   /* unknown; call String.getBytes */
+    NC_UTF8,
+    NC_LATIN1,                  /* ISO-8859-1 */
+    NC_ICONV                    /* iconv, or the ANSI code page on Win32 */
+} encoding;
+
+#ifndef _WIN32
+/* iconv descriptors are not thread-safe, so calls take cd_lock */
+static iconv_t cd_decode = (iconv_t)-1;
+static iconv_t cd_encode = (iconv_t)-1;
+static pthread_mutex_t cd_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Only needed by the String.getBytes fallback */
+static jclass Class_String;
+static jmethodID MID_String_init;
+static jmethodID MID_String_getBytes;
+
+static JNU_IDEntry ids[] = {
+    { JNU_CLASS, "java/lang/String", 0, 0, &Class_String },
+    { JNU_METHOD, "java/lang/String", "<init>", "([B)V",
+      &MID_String_init },
+    { JNU_METHOD, "java/lang/String", "getBytes", "()[B",
+      &MID_String_getBytes },
+};
+
+/* Returns the length of the ASCII prefix of the n bytes at s */
+static size_t
+asciiPrefix(const char *s, size_t n)
+{
+    size_t i = 0;
+#ifdef NC_SSE2
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        if (_mm_movemask_epi8(v) != 0) {
+            break; /* the loop below finds the byte */
+        }
+    }
+#endif
+    while (i < n && !(s[i] & 0x80)) {
+        i++;
+    }
+    return i;
+}
+
+/* Copies the ASCII prefix of the n chars at s to dst, one byte per
+ * char, and returns its length.
+ */
+static jsize
+narrowAscii(const jchar *s, jsize n, char *dst)
+{
+    jsize i = 0;
+#ifdef NC_SSE2
+    const __m128i high = _mm_set1_epi16((short)0xff80);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 8));
+        __m128i t = _mm_and_si128(_mm_or_si128(a, b), high);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(t, zero)) != 0xffff) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+#endif
+    for (; i < n && s[i] < 0x80; i++) {
+        dst[i] = (char)s[i];
+    }
+    return i;
+}
+
+/* Decodes n bytes of UTF-8 into buf, which has room for n chars, and
+ * returns the number of chars.  Each maximal prefix of a valid sequence
+ * that is cut short, and each byte that starts none, becomes one
+ * U+FFFD, the same replacements String(byte []) makes.
+ */
+static jsize
+decodeUTF8(const unsigned char *s, jsize n, jchar *buf)
+{
+    jsize i = 0, j, k = 0;
+
+    while (i < n) {
+        unsigned int c = s[i], cp, lo = 0x80, hi = 0xbf;
+        int extra;
+
+        if (c < 0x80) {
+            buf[k++] = (jchar)c;
+            i++;
+            continue;
+        }
+        /* The range of the second byte rules out overlong forms,
+           surrogates and code points above U+10FFFF. */
+        if (c >= 0xc2 && c < 0xe0) {
+            extra = 1; cp = c & 0x1f;
+        } else if (c >= 0xe0 && c < 0xf0) {
+            extra = 2; cp = c & 0x0f;
+            if (c == 0xe0) lo = 0xa0;
+            if (c == 0xed) hi = 0x9f;
+        } else if (c >= 0xf0 && c < 0xf5) {
+            extra = 3; cp = c & 0x07;
+            if (c == 0xf0) lo = 0x90;
+            if (c == 0xf4) hi = 0x8f;
+        } else {
+            buf[k++] = 0xfffd;
+            i++;
+            continue;
+        }
+        for (j = 1; j <= extra && i + j < n; j++) {
+            if (s[i + j] < lo || s[i + j] > hi) {
+                break; /* decoding resumes at this byte */
+            }
+            cp = (cp << 6) | (s[i + j] & 0x3f);
+            lo = 0x80;
+            hi = 0xbf;
+        }
+        i += j;
+        if (j <= extra) {
+            buf[k++] = 0xfffd;
+        } else if (cp >= 0x10000) {
+            cp -= 0x10000;
+            buf[k++] = (jchar)(0xd800 + (cp >> 10));
+            buf[k++] = (jchar)(0xdc00 + (cp & 0x3ff));
+        } else {
+            buf[k++] = (jchar)cp;
+        }
+    }
+    return k;
+}
+
+/* Encodes the n chars at s as UTF-8 into dst, or only counts the bytes
+ * if dst is NULL.  Unpaired surrogates become '?'.
+ */
+static size_t
+encodeUTF8(const jchar *s, jsize n, char *dst)
+{
+    size_t k = 0;
+    jsize i;
+
+    for (i = 0; i < n; i++) {
+        unsigned int c = s[i];
+        int len;
+
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < n &&
+            s[i + 1] >= 0xdc00 && s[i + 1] < 0xe000) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (s[++i] - 0xdc00);
+            len = 4;
+        } else if (c >= 0xd800 && c < 0xe000) {
+            c = '?';
+            len = 1;
+        } else {
+            len = c < 0x80 ? 1 : c < 0x800 ? 2 : 3;
+        }
+        if (dst != NULL) {
+            switch (len) {
+            case 1:
+                dst[k] = (char)c;
+                break;
+            case 2:
+                dst[k] = (char)(0xc0 | (c >> 6));
+                dst[k + 1] = (char)(0x80 | (c & 0x3f));
+                break;
+            case 3:
+                dst[k] = (char)(0xe0 | (c >> 12));
+                dst[k + 1] = (char)(0x80 | ((c >> 6) & 0x3f));
+                dst[k + 2] = (char)(0x80 | (c & 0x3f));
+                break;
+            default:
+                dst[k] = (char)(0xf0 | (c >> 18));
+                dst[k + 1] = (char)(0x80 | ((c >> 12) & 0x3f));
+                dst[k + 2] = (char)(0x80 | ((c >> 6) & 0x3f));
+                dst[k + 3] = (char)(0x80 | (c & 0x3f));
+                break;
+            }
+        }
+        k += len;
+    }
+    return k;
+}
+
+/* Decodes n bytes in the platform encoding into buf, which has room
+ * for n chars.  Returns the number of chars, or -1 if they do not fit.
+ */
+static jsize
+decodeIconv(const char *s, jsize n, jchar *buf)
+{
+#ifdef _WIN32
+    int k = MultiByteToWideChar(CP_ACP, 0, s, n, (LPWSTR)buf, n);
+    return k > 0 ? k : -1;
+#else
+    char *in = (char *)s, *out = (char *)buf;
+    size_t inleft = n, outleft = n * sizeof(jchar);
+    jsize result = 0;
+
+    pthread_mutex_lock(&cd_lock);
+    iconv(cd_decode, NULL, NULL, NULL, NULL);
+    while (inleft > 0) {
+        if (iconv(cd_decode, &in, &inleft, &out, &outleft) != (size_t)-1) {
+            break;
+        }
+        if (errno == E2BIG || outleft < sizeof(jchar)) {
+            result = -1;
+            break;
+        }
+        /* EILSEQ or EINVAL: replace one byte and go on */
+        *(jchar *)out = 0xfffd;
+        out += sizeof(jchar);
+        outleft -= sizeof(jchar);
+        in++;
+        inleft--;
+    }
+    pthread_mutex_unlock(&cd_lock);
+    return result < 0 ? -1 : (jsize)((jchar *)out - buf);
+#endif
+}
+
+/* Appends the n chars at s, encoded in the platform encoding, to the
+ * used bytes at dst, which was malloc'ed, and NUL-terminates the
+ * result.  Returns the possibly moved result, or NULL, having freed
+ * dst, if out of memory.
+ */
+static char *
+encodeIconv(const jchar *s, jsize n, char *dst, size_t used)
+{
+#ifdef _WIN32
+    int k = WideCharToMultiByte(CP_ACP, 0, (LPCWSTR)s, n, NULL, 0, "?", NULL);
+    char *p = (char *)realloc(dst, used + k + 1);
+
+    if (p == NULL) {
+        free(dst);
+        return NULL;
+    }
+    WideCharToMultiByte(CP_ACP, 0, (LPCWSTR)s, n, p + used, k, "?", NULL);
+    p[used + k] = 0;
+    return p;
+#else
+    char *in = (char *)s, *out, *p;
+    size_t inleft = n * sizeof(jchar), outleft, r;
+    size_t cap = used + n + 16;
+    int flushing;
+
+    if ((p = (char *)realloc(dst, cap)) == NULL) {
+        free(dst);
+        return NULL;
+    }
+    dst = p;
+    pthread_mutex_lock(&cd_lock);
+    iconv(cd_encode, NULL, NULL, NULL, NULL);
+    for (;;) {
+        /* Once all is converted, one more call returns a stateful
+           encoding to its initial shift state. */
+        flushing = inleft == 0;
+        out = dst + used;
+        outleft = cap - 1 - used;
+        r = flushing ? iconv(cd_encode, NULL, NULL, &out, &outleft)
+                     : iconv(cd_encode, &in, &inleft, &out, &outleft);
+        used = out - dst;
+        if (r != (size_t)-1) {
+            if (flushing) {
+                break;
+            }
+            continue;
+        }
+        if (errno != E2BIG && !flushing && outleft > 0) {
+            /* EILSEQ or EINVAL: replace one char and go on */
+            dst[used++] = '?';
+            in += sizeof(jchar);
+            inleft -= sizeof(jchar);
+            continue;
+        }
+        cap *= 2;
+        if ((p = (char *)realloc(dst, cap)) == NULL) {
+            free(dst);
+            dst = NULL;
+            break;
+        }
+        dst = p;
+    }
+    pthread_mutex_unlock(&cd_lock);
+    if (dst != NULL) {
+        dst[used] = 0;
+    }
+    return dst;
+#endif
+}
+
+/* Decodes n bytes in the platform encoding into buf, as decodeIconv */
+static jsize
+decode(const char *s, jsize n, jchar *buf)
+{
+    jsize i;
+
+    switch (encoding) {
+    case NC_UTF8:
+        return decodeUTF8((const unsigned char *)s, n, buf);
+    case NC_LATIN1:
+        for (i = 0; i < n; i++) {
+            buf[i] = (unsigned char)s[i];
+        }
+        return n;
+    default:
+        return decodeIconv(s, n, buf);
+    }
+}
+
+jstring
+JNU_NewStringNative(JNIEnv *env, const char *str)
+{
+    jchar stackbuf[256], *buf;
+    size_t i, len, ascii;
+    jsize n;
+    jstring result;
+
+    if (encoding == NC_OTHER) {
+        return JNU_NewStringNativeUpcall(env, str);
+    }
+    len = strlen(str);
+    ascii = asciiPrefix(str, len);
+    if (ascii == len) {
+        /* ASCII is also modified UTF-8 */
+        return (*env)->NewStringUTF(env, str);
+    }
+    if (len > 0x7fffffff / sizeof(jchar)) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+        return 0;
+    }
+    if (len <= sizeof(stackbuf) / sizeof(jchar)) {
+        buf = stackbuf;
+    } else if ((buf = (jchar *)malloc(len * sizeof(jchar))) == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+        return 0;
+    }
+    for (i = 0; i < ascii; i++) {
+        buf[i] = (jchar)str[i];
+    }
+    n = decode(str + ascii, (jsize)(len - ascii), buf + ascii);
+    if (n >= 0) {
+        result = (*env)->NewString(env, buf, (jsize)ascii + n);
+    } else {
+        result = JNU_NewStringNativeUpcall(env, str);
+    }
+    if (buf != stackbuf) {
+        free(buf);
+    }
+    return result;
+}
+
+char *
+JNU_GetStringNativeChars(JNIEnv *env, jstring jstr)
+{
+    const jchar *chars;
+    jchar *rest = NULL;
+    jsize i, n, len;
+    size_t size;
+    char *result, *p;
+
+    if (encoding == NC_OTHER) {
+        return JNU_GetStringNativeCharsUpcall(env, jstr);
+    }
+    len = (*env)->GetStringLength(env, jstr);
+    if ((result = (char *)malloc(len + 1)) == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+        return 0;
+    }
+    chars = (*env)->GetStringCritical(env, jstr, 0);
+    if (chars == NULL) {
+        free(result);
+        return 0; /* OutOfMemoryError already thrown */
+    }
+
+    /* Only C runs between here and ReleaseStringCritical */
+    n = narrowAscii(chars, len, result);
+    if (n == len) {
+        result[len] = 0;
+    } else if (encoding == NC_LATIN1) {
+        for (i = n; i < len; i++) {
+            result[i] = chars[i] < 0x100 ? (char)chars[i] : '?';
+        }
+        result[len] = 0;
+    } else if (encoding == NC_UTF8) {
+        size = n + encodeUTF8(chars + n, len - n, NULL);
+        if ((p = (char *)realloc(result, size + 1)) != NULL) {
+            encodeUTF8(chars + n, len - n, p + n);
+            p[size] = 0;
+        } else {
+            free(result);
+        }
+        result = p;
+    } else {
+        /* iconv takes a lock, so copy the rest out and convert it
+           after releasing the string */
+        rest = (jchar *)malloc((len - n) * sizeof(jchar));
+        if (rest != NULL) {
+            memcpy(rest, chars + n, (len - n) * sizeof(jchar));
+        } else {
+            free(result);
+            result = NULL;
+        }
+    }
+    (*env)->ReleaseStringCritical(env, jstr, chars);
+
+    if (rest != NULL) {
+        result = encodeIconv(rest, len - n, result, n);
+        free(rest);
+    }
+    if (result == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+    }
+    return result;
+}
+
+jstring
+JNU_NewStringNativeUpcall(JNIEnv *env, const char *str)
+{
+    jstring result;
+    jbyteArray bytes = 0;
+    int len;
+    if ((*env)->EnsureLocalCapacity(env, 2) < 0) {
+        return NULL; /* out of memory error */
+    }
+    len = strlen(str);
+    bytes = (*env)->NewByteArray(env, len);
+    if (bytes != NULL) {
+        (*env)->SetByteArrayRegion(env, bytes, 0, len,
+                                   (jbyte *)str);
+        result = (*env)->NewObject(env, Class_String,
+                                   MID_String_init, bytes);
+        (*env)->DeleteLocalRef(env, bytes);
+        return result;
+    } /* else fall through */
+    return NULL;
+}
+
+char *
+JNU_GetStringNativeCharsUpcall(JNIEnv *env, jstring jstr)
+{
+    jbyteArray bytes = 0;
+    jthrowable exc;
+    char *result = 0;
+    if ((*env)->EnsureLocalCapacity(env, 2) < 0) {
+        return 0; /* out of memory error */
+    }
+    bytes = (*env)->CallObjectMethod(env, jstr,
+                                     MID_String_getBytes);
+    exc = (*env)->ExceptionOccurred(env);
+    if (!exc) {
+        jint len = (*env)->GetArrayLength(env, bytes);
+        result = (char *)malloc(len + 1);
+        if (result == 0) {
+            JNU_ThrowByName(env, "java/lang/OutOfMemoryError",
+                            0);
+            (*env)->DeleteLocalRef(env, bytes);
+            return 0;
+        }
+        (*env)->GetByteArrayRegion(env, bytes, 0, len,
+                                   (jbyte *)result);
+        result[len] = 0; /* NULL-terminate */
+    } else {
+        (*env)->DeleteLocalRef(env, exc);
+    }
+    (*env)->DeleteLocalRef(env, bytes);
+    return result;
+}
+
+/* Copies the name of the platform encoding, as the VM knows it, to
+ * name.  Returns 0 if it cannot be found out.
+ */
+static int
+getEncodingName(JNIEnv *env, char *name, int size)
+{
+    static const char *props[] = { "sun.jnu.encoding", "file.encoding" };
+    jclass cls;
+    jmethodID mid;
+    jstring key, value = NULL;
+    const char *utf;
+    int i;
+
+    if ((cls = (*env)->FindClass(env, "java/lang/System")) == NULL ||
+        (mid = (*env)->GetStaticMethodID(env, cls, "getProperty",
+                 "(Ljava/lang/String;)Ljava/lang/String;")) == NULL) {
+        (*env)->ExceptionClear(env);
+        return 0;
+    }
+    for (i = 0; value == NULL && i < 2; i++) {
+        if ((key = (*env)->NewStringUTF(env, props[i])) == NULL) {
+            break;
+        }
+        value = (*env)->CallStaticObjectMethod(env, cls, mid, key);
+        (*env)->DeleteLocalRef(env, key);
+        if ((*env)->ExceptionCheck(env)) {
+            break;
+        }
+    }
+    (*env)->ExceptionClear(env);
+    (*env)->DeleteLocalRef(env, cls);
+    if (value == NULL ||
+        (utf = (*env)->GetStringUTFChars(env, value, 0)) == NULL) {
+        (*env)->ExceptionClear(env);
+        return 0;
+    }
+    strncpy(name, utf, size - 1);
+    name[size - 1] = 0;
+    (*env)->ReleaseStringUTFChars(env, value, utf);
+    (*env)->DeleteLocalRef(env, value);
+    return 1;
+}
+
+/* Compares encoding names ignoring case, '-' and '_' */
+static int
+sameEncoding(const char *a, const char *b)
+{
+    int ca, cb;
+
+    for (;;) {
+        while (*a == '-' || *a == '_') a++;
+        while (*b == '-' || *b == '_') b++;
+        ca = (*a >= 'A' && *a <= 'Z') ? *a + 'a' - 'A' : *a;
+        cb = (*b >= 'A' && *b <= 'Z') ? *b + 'a' - 'A' : *b;
+        if (ca != cb) {
+            return 0;
+        }
+        if (*a == 0) {
+            return 1;
+        }
+        a++;
+        b++;
+    }
+}
+
+#ifndef _WIN32
+static void
+closeIconv(void)
+{
+    if (cd_decode != (iconv_t)-1) {
+        iconv_close(cd_decode);
+        cd_decode = (iconv_t)-1;
+    }
+    if (cd_encode != (iconv_t)-1) {
+        iconv_close(cd_encode);
+        cd_encode = (iconv_t)-1;
+    }
+}
+
+static int
+openIconv(const char *name)
+{
+    static const jchar one = 1;
+    const char *utf16 = *(const char *)&one ? "UTF-16LE" : "UTF-16BE";
+
+    cd_decode = iconv_open(utf16, name);
+    cd_encode = iconv_open(name, utf16);
+    if (cd_decode == (iconv_t)-1 || cd_encode == (iconv_t)-1) {
+        closeIconv();
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+/* Does the platform encoding map the bytes 1 to 127 to ASCII? */
+static int
+asciiCompatible(void)
+{
+    char ascii[127];
+    jchar wide[127];
+    int i;
+
+    for (i = 0; i < 127; i++) {
+        ascii[i] = (char)(i + 1);
+    }
+    if (decodeIconv(ascii, 127, wide) != 127) {
+        return 0;
+    }
+    for (i = 0; i < 127; i++) {
+        if (wide[i] != i + 1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+jint
+JNU_InitNativeChars(JNIEnv *env)
+{
+    char name[64];
+
+    if (JNU_ResolveIDs(env, ids, JNU_NIDS(ids)) != JNI_OK) {
+        return JNI_ERR;
+    }
+    encoding = NC_OTHER;
+    if (!getEncodingName(env, name, sizeof(name))) {
+        return JNI_OK;
+    }
+    if (sameEncoding(name, "UTF-8")) {
+        encoding = NC_UTF8;
+    } else if (sameEncoding(name, "ISO-8859-1")) {
+        encoding = NC_LATIN1;
+    } else {
+#ifndef _WIN32
+        /* The VM's name for the encoding, or else the C library's */
+        if (!openIconv(name) && !openIconv(nl_langinfo(CODESET))) {
+            return JNI_OK;
+        }
+#endif
+        if (asciiCompatible()) {
+            encoding = NC_ICONV;
+        }
+#ifndef _WIN32
+        else {
+            closeIconv();
+        }
+#endif
+    }
+    return JNI_OK;
+}
+
+void
+JNU_ReleaseNativeChars(JNIEnv *env)
+{
+    encoding = NC_OTHER;
+#ifndef _WIN32
+    closeIconv();
+#endif
+    JNU_ReleaseIDs(env, ids, JNU_NIDS(ids));
+}
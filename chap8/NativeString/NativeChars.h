@@ -0,0 +1,55 @@
+#ifndef _NATIVECHARS_H_
+#define _NATIVECHARS_H_
+
+#include <jni.h>
+
+/*
+ * Conversion between Java strings and C strings in the platform
+ * encoding (the sun.jnu.encoding property), without String.getBytes
+ * or new String(byte[]) and the byte array each of them allocates.
+ *
+ * ASCII text is recognized with SSE2 on x86 and converted directly in
+ * any ASCII compatible encoding.  UTF-8 and ISO-8859-1 are converted
+ * in C; any other encoding goes through iconv (MultiByteToWideChar on
+ * Win32).  Only an encoding neither knows falls back to calling
+ * String.getBytes and new String(byte[]), as the book's versions do.
+ *
+ *     JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *jvm, void *reserved)
+ *     {
+ *         JNIEnv *env;
+ *         if ((*jvm)->GetEnv(jvm, (void **)&env, JNI_VERSION_1_2) ||
+ *             JNU_InitNativeChars(env) != JNI_OK) {
+ *             return JNI_ERR;
+ *         }
+ *         return JNI_VERSION_1_2;
+ *     }
+ */
+
+/*
+ * Find out the platform encoding and resolve the IDs the fallback
+ * needs.  Call once, from JNI_OnLoad.  Returns JNI_ERR, with no
+ * exception pending, if the IDs cannot be resolved; otherwise JNI_OK.
+ */
+jint JNU_InitNativeChars(JNIEnv *env);
+
+/* Undo JNU_InitNativeChars, from JNI_OnUnload */
+void JNU_ReleaseNativeChars(JNIEnv *env);
+
+/*
+ * Returns a new string decoded from str, or NULL with an exception
+ * pending.  Bytes that are not valid in the encoding become U+FFFD.
+ */
+jstring JNU_NewStringNative(JNIEnv *env, const char *str);
+
+/*
+ * Returns the string encoded as a NUL-terminated C string, which the
+ * caller must free(), or NULL with an exception pending.  Characters
+ * the encoding cannot represent become '?'.
+ */
+char *JNU_GetStringNativeChars(JNIEnv *env, jstring jstr);
+
+/* The String.getBytes and new String(byte[]) versions, for comparison */
+jstring JNU_NewStringNativeUpcall(JNIEnv *env, const char *str);
+char *JNU_GetStringNativeCharsUpcall(JNIEnv *env, jstring jstr);
+
+#endif /* _NATIVECHARS_H_ */
@@ -0,0 +1,70 @@
+/**
+ * Times converting strings to C strings in the platform encoding and
+ * back, through the native conversions in NativeChars.c and through
+ * the String.getBytes and new String(byte[]) upcalls they replace.
+ * <p>
+ * Each line gives the kind of text, its length in chars, then
+ * nanoseconds per round trip for each path.  Which text is converted
+ * without iconv depends on the platform encoding, printed first.
+ */
+class NativeStringBench {
+    private static native String roundTrip(String s, int count,
+                                           boolean upcall);
+
+    private static final int[] SIZES = { 1, 16, 256, 4096, 65536 };
+
+    /**
+     * @param args optional number of characters converted per size
+     *             and path (default 4000000)
+     */
+    public static void main(String args[]) {
+        long chars = args.length > 0 ? Long.parseLong(args[0]) : 4000000;
+        String[][] texts = {
+            { "ascii", "The quick brown fox jumps over the lazy dog. " },
+            { "latin1", "Caf\u00e9 cr\u00e8me br\u00fbl\u00e9e, na\u00efve " },
+            { "cjk", "\u65e5\u672c\u8a9e\u306e\u6587\u7ae0\u3002" },
+        };
+
+        System.out.println("encoding " +
+                           System.getProperty("sun.jnu.encoding"));
+        System.out.println("text\tchars\tnative ns\tupcall ns");
+        for (int t = 0; t < texts.length; t++) {
+            for (int i = 0; i < SIZES.length; i++) {
+                String s = repeat(texts[t][1], SIZES[i]);
+                int count = (int)Math.max(1, chars / SIZES[i]);
+
+                /* Both paths must agree before they are compared. */
+                if (!roundTrip(s, 1, false).equals(roundTrip(s, 1, true))) {
+                    throw new RuntimeException(texts[t][0] + " " +
+                                               SIZES[i] + " differs");
+                }
+                time(s, count / 10, false);
+                time(s, count / 10, true);
+                long tNative = time(s, count, false);
+                long tUpcall = time(s, count, true);
+                System.out.println(texts[t][0] + "\t" + SIZES[i] + "\t" +
+                                   tNative / count + "\t\t" +
+                                   tUpcall / count);
+            }
+        }
+    }
+
+    private static String repeat(String s, int len) {
+        StringBuffer sb = new StringBuffer(len);
+        while (sb.length() < len) {
+            sb.append(s);
+        }
+        sb.setLength(len);
+        return sb.toString();
+    }
+
+    private static long time(String s, int count, boolean upcall) {
+        long start = System.nanoTime();
+        roundTrip(s, count, upcall);
+        return System.nanoTime() - start;
+    }
+
+    static {
+        System.loadLibrary("NativeString");
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * %W% %E%
+ *
+ * Copyright (c) 1998 Sun Microsystems, Inc. All Rights Reserved.
+ *
+ * See also the LICENSE file in this distribution.
+ */
+
+/**
+ * A region of C memory from which many blocks are allocated and then
+ * released all at once.
+ * <p>
+ * <code>CArena</code> replaces the idiom of pairing every
+ * <code>CMalloc</code> with a <code>free</code>.  Blocks are carved out
+ * of large chunks obtained from <code>malloc</code>; allocating one only
+ * bumps a pointer, in Java code, and <code>close</code> frees every chunk
+ * in a single native method call:
+ * <pre>
+ *     try (CArena arena = new CArena()) {
+ *         CPointer buf = arena.alloc(128, 8);
+ *         scanf.callInt(new Object[]{ "%s", buf });
+ *         ...
+ *     }
+ * </pre>
+ * The blocks are plain <code>CPointer</code>s and can be passed to a
+ * <code>CFunction</code> like any other.  None of them may be used after
+ * the arena is closed.  An arena is not safe for use by several threads
+ * at once.
+ *
+ * @see CMalloc
+ * @see CPointer
+ */
+public class CArena implements java.io.Closeable {
+
+    /** The chunk size used by <code>CArena()</code>. */
+    public static final int DEFAULT_CHUNK_SIZE = 65536;
+
+    /* Size of the chunks to carve blocks out of. */
+    private final int chunkSize;
+
+    /* Most recently allocated chunk; the chunks are linked in C. */
+    private long chunks;
+
+    /* Free space in the chunk being carved up: [cur, end). */
+    private long cur, end;
+
+    private boolean closed;
+
+    /* Get a chunk of at least size bytes, linked in front of next. */
+    private static native long newChunk(long next, int size);
+
+    /* Free a chunk and all those linked behind it. */
+    private static native void freeChunks(long chunks);
+
+    /**
+     * Create an arena that allocates chunks of
+     * <code>DEFAULT_CHUNK_SIZE</code> bytes.
+     */
+    public CArena() {
+        this(DEFAULT_CHUNK_SIZE);
+    }
+
+    /**
+     * Create an arena that allocates chunks of the given size.  Blocks
+     * bigger than a quarter of a chunk get a chunk of their own.
+     *
+     * @param chunkSize size of the chunks, in bytes
+     */
+    public CArena(int chunkSize) {
+        if (chunkSize <= 0) {
+	    throw new IllegalArgumentException("chunk size must be positive");
+	}
+        this.chunkSize = chunkSize;
+    }
+
+    /**
+     * Allocate a block aligned to 8 bytes.
+     *
+     * @param size number of <em>bytes</em> to allocate
+     * @return     a pointer to the block
+     * @see #alloc(int, int)
+     */
+    public CPointer alloc(int size) {
+        return alloc(size, 8);
+    }
+
+    /**
+     * Allocate a block from the arena.  The block lives until the arena
+     * is closed.
+     *
+     * @param size  number of <em>bytes</em> to allocate
+     * @param align alignment of the block, a power of two no larger than
+     *		    16
+     * @return      a pointer to the block
+     * @exception IllegalStateException if the arena is closed
+     * @exception OutOfMemoryError if C memory is exhausted
+     */
+    public CPointer alloc(int size, int align) {
+        if (closed) {
+	    throw new IllegalStateException("arena is closed");
+	}
+	if (size < 0 || align <= 0 || align > 16 || (align & (align - 1)) != 0) {
+	    throw new IllegalArgumentException();
+	}
+
+	long p = (cur + align - 1) & -align;
+	if (p + size > end || cur == 0) {
+	    if (size > chunkSize / 4) {
+	        /* Chunks are 16-byte aligned, so this one is too. */
+	        chunks = newChunk(chunks, size);
+		return pointer(chunks);
+	    }
+	    chunks = newChunk(chunks, chunkSize);
+	    cur = chunks;
+	    end = chunks + chunkSize;
+	    p = (cur + align - 1) & -align;
+	}
+	cur = p + size;
+	return pointer(p);
+    }
+
+    /**
+     * Free all memory allocated from the arena.  Closing an arena twice is
+     * harmless.
+     */
+    public void close() {
+        if (!closed) {
+	    closed = true;
+	    freeChunks(chunks);
+	    chunks = cur = end = 0;
+	}
+    }
+
+    private static CPointer pointer(long p) {
+        CPointer ptr = new CPointer();
+	ptr.peer = p;
+	return ptr;
+    }
+}
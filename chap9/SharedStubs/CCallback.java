@@ -0,0 +1,102 @@
+/*
+ * %W% %E%
+ *
+ * Copyright (c) 1998 Sun Microsystems, Inc. All Rights Reserved.
+ *
+ * See also the LICENSE file in this distribution.
+ */
+
+/**
+ * A C function pointer that calls a Java method.  An instance of
+ * <code>CCallback</code> can be passed to a <code>CFunction</code>
+ * wherever the C function expects a callback, such as the comparator
+ * of <code>qsort</code>:
+ * <pre>
+ *     class Ints {
+ *         CPointer base;
+ *         int compare(long a, long b) {
+ *             return base.getInt((int)(a - base.peer)) -
+ *                    base.getInt((int)(b - base.peer));
+ *         }
+ *     }
+ *     CCallback cmp = new CCallback(ints, "compare", "(P,P)I");
+ *     try {
+ *         qsort.callVoid(new Object[]{ buf, new Integer(n),
+ *                                      new Integer(4), cmp });
+ *     } finally {
+ *         cmp.close();
+ *     }
+ * </pre>
+ * The signature has the same form as for <code>CFunction.bind</code>.
+ * The method must be an instance method of the target whose parameter
+ * and return types follow from it: <code>I</code> is <code>int</code>,
+ * <code>J</code> and <code>P</code> are <code>long</code>,
+ * <code>F</code> is <code>float</code>, <code>D</code> is
+ * <code>double</code> and <code>V</code> is <code>void</code>.
+ * <p>
+ * The method is looked up once, when the callback is created, and the
+ * machine code that C calls comes from a pool that closed callbacks are
+ * returned to, so creating a callback is cheap and calling one costs
+ * about as much as a cached JNI upcall.  C may call it from any thread;
+ * threads unknown to the virtual machine are attached for the duration
+ * of the call.  An exception thrown by the method is left pending until
+ * the C function returns to Java, and C sees a zero result.  Until then,
+ * further calls on that thread also return zero, without running the
+ * method.
+ * <p>
+ * A callback holds a strong reference to its target until it is closed,
+ * and must not be called by C after that.  Callbacks are only supported
+ * on x86-64.
+ *
+ * @see CFunction
+ */
+public class CCallback extends CPointer implements java.io.Closeable {
+
+    /* Callback slot in C, 0 once closed. */
+    private long slot;
+
+    /* Bind a slot to the method; sets peer and slot. */
+    private native void create(Object target, String method, long sig);
+
+    /* Return a slot to the pool. */
+    private static native void release(long slot);
+
+    private static native void initIDs();
+
+    static {
+        initIDs();
+    }
+
+    /**
+     * Create a C function pointer that calls a method of an object.
+     *
+     * @param target    the object to call the method on
+     * @param method    the method name
+     * @param signature the C signature of the callback, as for
+     *                  <code>CFunction.bind</code>
+     * @exception IllegalArgumentException if the signature is malformed
+     * @exception NoSuchMethodError if the target has no such method
+     * @exception UnsupportedOperationException if callbacks are not
+     *		  supported on this platform
+     * @see CFunction#bind(String)
+     */
+    public CCallback(Object target, String method, String signature) {
+        if (target == null) {
+	    throw new NullPointerException();
+	}
+	create(target, method, CFunction.compileSignature(signature));
+    }
+
+    /**
+     * Release the function pointer, so that its machine code can be
+     * reused by another callback.  Closing a callback twice is harmless.
+     * Not safe to call while C may still call the function pointer.
+     */
+    public void close() {
+        if (slot != 0) {
+	    release(slot);
+	    slot = 0;
+	    peer = 0;
+	}
+    }
+}
@@ -13,6 +13,16 @@
  * provide means to call the function; select a <code>XXX</code> variant based
  * on the return type of the C function.
  *<p>
+ * The <code>Object[]</code> arguments are converted as follows:
+ * <code>Integer</code>, <code>Short</code>, <code>Byte</code>,
+ * <code>Character</code> and <code>Boolean</code> are passed as C
+ * <code>int</code>s, <code>Long</code> as a 64-bit integer,
+ * <code>Float</code> and <code>Double</code> as themselves,
+ * <code>String</code> as a C string in the platform encoding,
+ * <code>CPointer</code> and <code>null</code> as pointers,
+ * <code>CStruct.Value</code> as a struct by value, and primitive arrays
+ * as pointers to their elements; see <code>setCritical</code>.
+ *<p>
  * Beware that the <code>copyIn</code>, <code>copyOut</code>,
  * <code>setXXX</code>, and <code>getXXX</code> methods inherited from the
  * parent will indirect machine code.
@@ -27,9 +37,22 @@ public class CFunction extends CPointer {
     /* calling convention */
     private int conv;
 
+    /* precompiled call signature, 0 if none is bound */
+    private long sig;
+
+    /* pin array arguments rather than copy them */
+    private boolean critical;
+
     /* Find names function in the named dll. */
     private native long find(String lib, String fname);
 
+    /* Call through dispatch with a struct result of the given layout. */
+    private native void invokeStruct(long plan, int size, long dest,
+				     Object[] args);
+
+    /* Parse and intern a call signature; also used by CCallback. */
+    static native long compileSignature(String signature);
+
     private static native void initIDs();
 
     static {
@@ -115,6 +138,16 @@ public class CFunction extends CPointer {
      */
     public native float callFloat(Object[] args);
 
+    /**
+     * Call the C function being represented by this object.
+     *
+     * @param  args arguments to pass to the C function
+     * @return      64-bit integer value (<code>int64_t</code>,
+     *		    <code>long long</code>, <code>off_t</code>, ...)
+     *		    returned by the underlying C function
+     */
+    public native long callLong(Object[] args);
+
     /**
      * Call the C function being represented by this object.
      *
@@ -132,6 +165,239 @@ public class CFunction extends CPointer {
      */
     public native CPointer callCPointer(Object[] args);
 
+    /**
+     * Call the C function being represented by this object, which returns
+     * a struct by value.
+     * <p>
+     * The struct is stored at <code>dest</code>, which must have room for
+     * <code>layout.size()</code> bytes.  Arguments are as for
+     * <code>callInt(Object[])</code>, and may themselves include structs
+     * from <code>CStruct.byValue</code>.  Structs are passed and returned
+     * in registers or memory as the platform ABI requires, so no wrapper
+     * function is needed.  Not supported on SPARC.
+     *
+     * @param  layout the layout of the returned struct
+     * @param  dest   where to store the returned struct
+     * @param  args   arguments to pass to the C function
+     * @return        <code>dest</code>
+     * @exception UnsupportedOperationException on SPARC
+     * @see CStruct#byValue(CPointer, int)
+     */
+    public CPointer callStruct(CStruct layout, CPointer dest, Object[] args) {
+        dest.checkRange(0, layout.size());
+	invokeStruct(layout.plan, layout.size(), dest.peer, args);
+	return dest;
+    }
+
+    /**
+     * Choose how primitive array arguments are passed.
+     * <p>
+     * By default an array argument is passed as a pointer to a copy of
+     * its elements, which is copied back into the array when the C
+     * function returns.  A critical <code>CFunction</code> instead pins
+     * the arrays with <code>GetPrimitiveArrayCritical</code> and passes
+     * pointers to the elements themselves, so that no data is copied.
+     * The virtual machine may hold up garbage collection, and so every
+     * other thread, while arrays are pinned: only make short, non-blocking
+     * C functions critical, and never ones that call back into Java
+     * through a <code>CCallback</code>.
+     *
+     * @param  critical <code>true</code> to pin array arguments
+     * @return          this <code>CFunction</code>
+     */
+    public CFunction setCritical(boolean critical) {
+        this.critical = critical;
+	return this;
+    }
+
+    /**
+     * Bind this <code>CFunction</code> to a fixed call signature.
+     * <p>
+     * The signature is compiled once into a marshalling plan, which the
+     * typed <code>callXXX(long[], double[])</code> methods then use to
+     * pass primitive arguments without examining them one by one.  A
+     * signature lists the argument types in parentheses, separated by
+     * commas, followed by the return type:
+     * <pre>
+     *     I  int              F  float
+     *     D  double           P  pointer (address as a long)
+     *     J  64-bit integer   V  void (return type only)
+     * </pre>
+     * For example, <code>"(I,P,D)I"</code> describes
+     * <code>int f(int, void *, double)</code>.
+     *
+     * @param  signature the call signature
+     * @return           this <code>CFunction</code>
+     * @exception IllegalArgumentException if the signature is malformed
+     */
+    public CFunction bind(String signature) {
+        sig = compileSignature(signature);
+	return this;
+    }
+
+    /**
+     * Call the C function through the signature it is bound to.
+     * <code>I</code>, <code>J</code> and <code>P</code> arguments are
+     * taken in order from <code>iargs</code>, <code>F</code> and
+     * <code>D</code> arguments in order from <code>fargs</code>.  Either
+     * array may be <code>null</code> if the signature takes no arguments
+     * from it.
+     *
+     * @param  iargs integer and pointer arguments
+     * @param  fargs floating point arguments
+     * @return       <code>int</code> value returned by the underlying
+     *		     C function
+     * @exception IllegalStateException if no signature with an
+     *		     <code>I</code> return type is bound
+     * @see #bind(String)
+     */
+    public native int callInt(long[] iargs, double[] fargs);
+
+    /**
+     * Call the C function through the signature it is bound to.
+     *
+     * @param  iargs integer and pointer arguments
+     * @param  fargs floating point arguments
+     * @see #callInt(long[], double[])
+     */
+    public native void callVoid(long[] iargs, double[] fargs);
+
+    /**
+     * Call the C function through the signature it is bound to.
+     *
+     * @param  iargs integer and pointer arguments
+     * @param  fargs floating point arguments
+     * @return       <code>float</code> value returned by the underlying
+     *		     C function
+     * @see #callInt(long[], double[])
+     */
+    public native float callFloat(long[] iargs, double[] fargs);
+
+    /**
+     * Call the C function through the signature it is bound to.
+     *
+     * @param  iargs integer and pointer arguments
+     * @param  fargs floating point arguments
+     * @return       64-bit integer value returned by the underlying
+     *		     C function
+     * @see #callInt(long[], double[])
+     */
+    public native long callLong(long[] iargs, double[] fargs);
+
+    /**
+     * Call the C function through the signature it is bound to.
+     *
+     * @param  iargs integer and pointer arguments
+     * @param  fargs floating point arguments
+     * @return       <code>double</code> value returned by the underlying
+     *		     C function
+     * @see #callInt(long[], double[])
+     */
+    public native double callDouble(long[] iargs, double[] fargs);
+
+    /**
+     * Call the C function through the signature it is bound to.
+     *
+     * @param  iargs integer and pointer arguments
+     * @param  fargs floating point arguments
+     * @return       C pointer returned by the underlying C function
+     * @see #callInt(long[], double[])
+     */
+    public native CPointer callCPointer(long[] iargs, double[] fargs);
+
+    /**
+     * Call the C function <code>count</code> times through the signature
+     * it is bound to, in a single native method call.
+     * <p>
+     * Arguments are laid out in columns: the <em>j</em>-th integer or
+     * pointer argument of call <em>i</em> is
+     * <code>iargs[j * count + i]</code>, and likewise for
+     * <code>fargs</code>.  Pointer arguments are byte offsets from
+     * <code>base</code>, or absolute addresses if <code>base</code> is
+     * <code>null</code>.
+     *
+     * @param base    base address for pointer arguments, or
+     *		      <code>null</code>
+     * @param count   number of calls to make
+     * @param iargs   integer and pointer arguments, by column
+     * @param fargs   floating point arguments, by column
+     * @param results receives the <code>int</code> value returned by each
+     *		      call
+     * @exception IllegalStateException if no signature with an
+     *		      <code>I</code> return type is bound
+     * @exception IndexOutOfBoundsException if an array is too short
+     * @see #bind(String)
+     */
+    public native void callIntBatch(CPointer base, int count,
+				    long[] iargs, double[] fargs,
+				    int[] results);
+
+    /**
+     * Call the C function <code>count</code> times through the signature
+     * it is bound to, in a single native method call.
+     *
+     * @param base    base address for pointer arguments, or
+     *		      <code>null</code>
+     * @param count   number of calls to make
+     * @param iargs   integer and pointer arguments, by column
+     * @param fargs   floating point arguments, by column
+     * @param results receives the <code>double</code> value returned by
+     *		      each call
+     * @see #callIntBatch(CPointer, int, long[], double[], int[])
+     */
+    public native void callDoubleBatch(CPointer base, int count,
+				       long[] iargs, double[] fargs,
+				       double[] results);
+
+    /**
+     * Returns the largest amount of scratch memory, in bytes, that any
+     * thread has needed at one time to convert call arguments.
+     * <p>
+     * Temporary C strings are carved out of a per-thread arena whose
+     * first <code>SCRATCH_SIZE</code> bytes (4096 unless redefined when
+     * compiling <code>dispatch.cpp</code>) are thread-local storage; a
+     * thread that needs more allocates overflow chunks once and keeps
+     * them.  A high-water mark well above <code>SCRATCH_SIZE</code>
+     * suggests raising it.
+     *
+     * @return the scratch high-water mark in bytes
+     */
+    public static native long getScratchHighWater();
+
+    /**
+     * Unload a library that <code>CFunction</code>s have been found in.
+     * <p>
+     * Libraries are loaded once and every symbol found in them is
+     * cached, so constructing the same <code>CFunction</code> again is
+     * only a hash lookup.  This drops the cached symbols of the named
+     * library and releases the library.  A <code>CFunction</code>
+     * already found in it must not be called afterwards; a new one
+     * loads the library again.
+     *
+     * @param  lib the library name, exactly as passed to the constructor
+     * @return     <code>true</code> if the library was loaded
+     */
+    public static native boolean unloadLibrary(String lib);
+
+    /**
+     * Returns the number of times a <code>CFunction</code> constructor
+     * found its symbol already resolved.
+     *
+     * @return the symbol cache hit count
+     * @see #unloadLibrary(String)
+     */
+    public static native long getSymbolCacheHits();
+
+    /**
+     * Returns the number of times a <code>CFunction</code> constructor
+     * had to look its symbol up in the library, including lookups that
+     * failed.
+     *
+     * @return the symbol cache miss count
+     * @see #unloadLibrary(String)
+     */
+    public static native long getSymbolCacheMisses();
+
     /* Don't allow creation of unitializaed CFunction objects. */
     private CFunction() {}
 
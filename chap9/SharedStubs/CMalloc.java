@@ -6,6 +6,10 @@
  * See also the LICENSE file in this distribution.
  */
 
+import java.lang.ref.PhantomReference;
+import java.lang.ref.ReferenceQueue;
+import java.nio.ByteBuffer;
+
 /**
  * A <code>CPointer</code> to memory obtained from the C heap via a call to
  * <code>malloc</code>.
@@ -22,7 +26,11 @@
  * <b>Remember to <code>free</code> any <code>malloc</code> space
  * explicitly</b>.  This class could perhaps contain a <code>finalize</code>
  * method that does the <code>free</code>, but note that in Java you should
- * not use finalizers to free resources.
+ * not use finalizers to free resources.  Where explicit freeing is
+ * impractical, <code>autoFree</code> hands the space back once the
+ * <code>CMalloc</code> becomes unreachable, and
+ * <code>setTracking</code> records every live allocation so that leaks
+ * can be found with <code>dumpAllocations</code>.
  *
  * @author Sheng Liang
  * @see CPointer
@@ -35,17 +43,261 @@ public class CMalloc extends CPointer {
      * @param size number of <em>bytes</em> of space to allocate
      */
     public CMalloc(int size) {
-        this.size = size;
-        peer = malloc(size);
+        this(size, false);
+    }
+
+    /**
+     * Allocate space either in the C heap, or from a pool of size-classed
+     * blocks.
+     * <p>
+     * Pooled allocation suits many small, short-lived buffers: blocks of
+     * up to 2048 bytes are taken from a per-thread free list without
+     * calling <code>malloc</code> or taking a lock, and larger ones fall
+     * back to <code>malloc</code>.  A pooled block is rounded up to a
+     * power of two, at least 16 bytes, and is 16-byte aligned; larger
+     * ones are aligned as <code>malloc</code> aligns them.  If a scope is
+     * open on this thread, the block belongs to it.
+     *
+     * @param size   number of <em>bytes</em> of space to allocate
+     * @param pooled <code>true</code> to allocate from the pool
+     * @see #pushScope()
+     * @see #getPoolStats()
+     */
+    public CMalloc(int size, boolean pooled) {
+        if (!pooled) {
+	    this.size = size;
+	    peer = malloc(size);
+	} else {
+	    if (size < 0) {
+	        throw new IllegalArgumentException("negative size");
+	    }
+	    this.size = size;
+	    this.pooled = true;
+	    peer = poolAlloc(size);
+	    Scope s = (Scope)scope.get();
+	    if (s != null && peer != 0) {
+	        scopeNext = s.blocks;
+		s.blocks = this;
+	    }
+	}
 	if (peer == 0) {
 	    throw new OutOfMemoryError();
 	}
+	if (tracking) {
+	    track(peer, size, site());
+	}
+	reclaim();
     }
 
     /**
-     * De-allocate space obtained via an earlier call to <code>malloc</code>.
+     * De-allocate space obtained via an earlier call to <code>malloc</code>,
+     * or return a pooled block to the pool.  Freeing twice is harmless.
      */
-    public native void free();
+    public void free() {
+        disarm();
+        if (pooled) {
+	    poolFree(peer, size);
+	} else {
+	    free(peer);
+	}
+	peer = 0;
+    }
+
+    /**
+     * Have the space freed automatically once this <code>CMalloc</code>
+     * is no longer reachable.  Freeing it explicitly is still allowed,
+     * and is cheaper.
+     * <p>
+     * Unreachable blocks are noticed by the garbage collector and freed
+     * the next time a <code>CMalloc</code> is allocated, or when
+     * <code>reclaim</code> is called.  Any <code>CPointer</code> derived
+     * from this one, for example with <code>getCPointer</code>, does not
+     * keep the space alive.
+     *
+     * @return this <code>CMalloc</code>
+     * @exception IllegalStateException if the space was already freed
+     * @see #reclaim()
+     */
+    public CMalloc autoFree() {
+        if (peer == 0) {
+	    throw new IllegalStateException("already freed");
+	}
+	if (reclaimer == null) {
+	    reclaimer = new Reclaimer(this);
+	    synchronized (reclaimed) {
+	        reclaimer.next = reclaimers;
+		if (reclaimers != null) {
+		    reclaimers.prev = reclaimer;
+		}
+		reclaimers = reclaimer;
+	    }
+	}
+	return this;
+    }
+
+    /**
+     * Free the space of every <code>autoFree</code> block that the
+     * garbage collector has found to be unreachable, in a single native
+     * method call.
+     *
+     * @return the number of blocks freed
+     * @see #autoFree()
+     */
+    public static int reclaim() {
+        Reclaimer r = (Reclaimer)reclaimed.poll();
+	if (r == null) {
+	    return 0;
+	}
+	long[] peers = new long[16];
+	int[] sizes = new int[16];
+	int n = 0;
+	for (; r != null; r = (Reclaimer)reclaimed.poll()) {
+	    r.unlink();
+	    if (n == peers.length) {
+	        long[] p = new long[n * 2];
+		int[] s = new int[n * 2];
+		System.arraycopy(peers, 0, p, 0, n);
+		System.arraycopy(sizes, 0, s, 0, n);
+		peers = p;
+		sizes = s;
+	    }
+	    peers[n] = r.peer;
+	    sizes[n++] = r.pooled ? r.size : -1;
+	}
+	freeBulk(peers, sizes, n);
+	return n;
+    }
+
+    /**
+     * Turn recording of live allocations on or off.  While it is on,
+     * every <code>CMalloc</code> allocated is entered in a native registry
+     * with its size and the place in the code that allocated it, and is
+     * removed again when freed.  Turning it off empties the registry.
+     * Recording costs a stack walk and a lock per allocation.
+     *
+     * @param on <code>true</code> to record allocations
+     * @see #dumpAllocations()
+     */
+    public static void setTracking(boolean on) {
+        enableTracking(on);
+	tracking = on;
+    }
+
+    /**
+     * Returns a report of the allocations recorded since tracking was
+     * turned on that have not been freed: the total, then the bytes and
+     * number of blocks for each allocation site, largest first.
+     *
+     * @return the report, one line per site
+     * @see #setTracking(boolean)
+     */
+    public static native String dumpAllocations();
+
+    /**
+     * De-allocate a number of blocks in a single native method call.
+     * Heap and pooled blocks may be mixed, and <code>null</code> entries
+     * and blocks that are already free are skipped.
+     *
+     * @param blocks the blocks to free
+     */
+    public static void free(CMalloc[] blocks) {
+        long[] peers = new long[blocks.length];
+	int[] sizes = new int[blocks.length];
+	int n = 0;
+	for (int i = 0; i < blocks.length; i++) {
+	    CMalloc b = blocks[i];
+	    if (b != null && b.peer != 0) {
+	        b.disarm();
+	        peers[n] = b.peer;
+		sizes[n++] = b.pooled ? b.size : -1;
+		b.peer = 0;
+	    }
+	}
+	freeBulk(peers, sizes, n);
+    }
+
+    /**
+     * Open a scope on the current thread.  Every pooled block allocated on
+     * this thread until the matching <code>popScope</code> belongs to the
+     * scope, and any of them still live when it is popped are freed
+     * together.  Scopes nest.
+     *
+     * @see #popScope()
+     */
+    public static void pushScope() {
+        Scope s = new Scope();
+	s.outer = (Scope)scope.get();
+	scope.set(s);
+    }
+
+    /**
+     * Close the innermost scope on the current thread, freeing the pooled
+     * blocks allocated in it that have not been freed already.
+     *
+     * @exception IllegalStateException if no scope is open
+     * @see #pushScope()
+     */
+    public static void popScope() {
+        Scope s = (Scope)scope.get();
+	if (s == null) {
+	    throw new IllegalStateException("no scope");
+	}
+	scope.set(s.outer);
+
+	int n = 0;
+	for (CMalloc b = s.blocks; b != null; b = b.scopeNext) {
+	    n++;
+	}
+	CMalloc[] blocks = new CMalloc[n];
+	n = 0;
+	for (CMalloc b = s.blocks; b != null; b = b.scopeNext) {
+	    blocks[n++] = b;
+	}
+	free(blocks);
+    }
+
+    /** Index in <code>getPoolStats</code> of the bytes live in pooled
+        blocks, as requested rather than rounded up. */
+    public static final int STAT_LIVE_BYTES = 0;
+    /** Index in <code>getPoolStats</code> of the bytes held in slabs,
+        which pooled blocks are carved from. */
+    public static final int STAT_SLAB_BYTES = 1;
+    /** Index in <code>getPoolStats</code> of the bytes live in pooled
+        allocations too large for any size class. */
+    public static final int STAT_LARGE_BYTES = 2;
+    /** Index in <code>getPoolStats</code> of the blocks of size class 0
+        in use; class <em>c</em> is at <code>STAT_IN_USE + 2 * c</code>. */
+    public static final int STAT_IN_USE = 3;
+    /** Index in <code>getPoolStats</code> of the blocks of size class 0
+        carved from slabs; class <em>c</em> is at
+        <code>STAT_CARVED + 2 * c</code>. */
+    public static final int STAT_CARVED = 4;
+    /** Number of size classes; class <em>c</em> holds blocks of
+        <code>16 &lt;&lt; c</code> bytes. */
+    public static final int POOL_CLASSES = 8;
+
+    /**
+     * Returns the pool's counters, indexed by the <code>STAT_</code>
+     * constants.  The counters are read without stopping other threads,
+     * so they may be slightly out of step with each other.
+     *
+     * @return a new array of counters
+     */
+    public static native long[] getPoolStats();
+
+    /**
+     * Returns the fraction of slab memory not holding live data, whether
+     * lost to rounding up to a size class or sitting in free lists.
+     *
+     * @return a number between 0 and 1
+     */
+    public static double getPoolFragmentation() {
+        long[] stats = getPoolStats();
+	if (stats[STAT_SLAB_BYTES] == 0) {
+	    return 0;
+	}
+	return 1.0 - (double)stats[STAT_LIVE_BYTES] / stats[STAT_SLAB_BYTES];
+    }
 
     /**
      * Indirect the C pointer to <code>malloc</code> space, a la
@@ -243,6 +495,327 @@ public class CMalloc extends CPointer {
 	super.copyOut(bOff, buf, index, length);
     }
 
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.getBytes</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#getBytes(int, int, byte[], int, int)
+     */
+    public void getBytes(int bOff, int stride, byte[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 1);
+	super.getBytes(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.setBytes</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#setBytes(int, int, byte[], int, int)
+     */
+    public void setBytes(int bOff, int stride, byte[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 1);
+	super.setBytes(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.gatherBytes</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#gatherBytes(int[], byte[], int, int)
+     */
+    public void gatherBytes(int[] offsets, byte[] buf, int index, int length) {
+        gatherCheck(offsets, length, 1);
+	super.gatherBytes(offsets, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.getShorts</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#getShorts(int, int, short[], int, int)
+     */
+    public void getShorts(int bOff, int stride, short[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 2);
+	super.getShorts(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.setShorts</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#setShorts(int, int, short[], int, int)
+     */
+    public void setShorts(int bOff, int stride, short[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 2);
+	super.setShorts(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.gatherShorts</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#gatherShorts(int[], short[], int, int)
+     */
+    public void gatherShorts(int[] offsets, short[] buf, int index, int length) {
+        gatherCheck(offsets, length, 2);
+	super.gatherShorts(offsets, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.getChars</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#getChars(int, int, char[], int, int)
+     */
+    public void getChars(int bOff, int stride, char[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 2);
+	super.getChars(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.setChars</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#setChars(int, int, char[], int, int)
+     */
+    public void setChars(int bOff, int stride, char[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 2);
+	super.setChars(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.gatherChars</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#gatherChars(int[], char[], int, int)
+     */
+    public void gatherChars(int[] offsets, char[] buf, int index, int length) {
+        gatherCheck(offsets, length, 2);
+	super.gatherChars(offsets, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.getInts</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#getInts(int, int, int[], int, int)
+     */
+    public void getInts(int bOff, int stride, int[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 4);
+	super.getInts(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.setInts</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#setInts(int, int, int[], int, int)
+     */
+    public void setInts(int bOff, int stride, int[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 4);
+	super.setInts(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.gatherInts</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#gatherInts(int[], int[], int, int)
+     */
+    public void gatherInts(int[] offsets, int[] buf, int index, int length) {
+        gatherCheck(offsets, length, 4);
+	super.gatherInts(offsets, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.getLongs</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#getLongs(int, int, long[], int, int)
+     */
+    public void getLongs(int bOff, int stride, long[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 8);
+	super.getLongs(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.setLongs</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#setLongs(int, int, long[], int, int)
+     */
+    public void setLongs(int bOff, int stride, long[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 8);
+	super.setLongs(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.gatherLongs</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#gatherLongs(int[], long[], int, int)
+     */
+    public void gatherLongs(int[] offsets, long[] buf, int index, int length) {
+        gatherCheck(offsets, length, 8);
+	super.gatherLongs(offsets, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.getFloats</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#getFloats(int, int, float[], int, int)
+     */
+    public void getFloats(int bOff, int stride, float[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 4);
+	super.getFloats(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.setFloats</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#setFloats(int, int, float[], int, int)
+     */
+    public void setFloats(int bOff, int stride, float[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 4);
+	super.setFloats(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.gatherFloats</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#gatherFloats(int[], float[], int, int)
+     */
+    public void gatherFloats(int[] offsets, float[] buf, int index, int length) {
+        gatherCheck(offsets, length, 4);
+	super.gatherFloats(offsets, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.getDoubles</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#getDoubles(int, int, double[], int, int)
+     */
+    public void getDoubles(int bOff, int stride, double[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 8);
+	super.getDoubles(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.setDoubles</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#setDoubles(int, int, double[], int, int)
+     */
+    public void setDoubles(int bOff, int stride, double[] buf, int index,
+			int length) {
+        stridedCheck(bOff, stride, length, 8);
+	super.setDoubles(bOff, stride, buf, index, length);
+    }
+
+    /**
+     * Indirect the C pointer to <code>malloc</code> space, a la
+     * <code>CPointer.gatherDoubles</code>.  But this method performs a bounds
+     * checks to
+     * ensure that the indirection does not cause memory outside the
+     * <code>malloc</code>ed space to be accessed.
+     *
+     * @see CPointer#gatherDoubles(int[], double[], int, int)
+     */
+    public void gatherDoubles(int[] offsets, double[] buf, int index, int length) {
+        gatherCheck(offsets, length, 8);
+	super.gatherDoubles(offsets, buf, index, length);
+    }
+
+    /**
+     * Wrap <code>malloc</code> space in a direct <code>ByteBuffer</code>,
+     * a la <code>CPointer.asByteBuffer</code>.  But this method checks
+     * that the buffer lies within the <code>malloc</code>ed space, after
+     * which the buffer's own bounds checks keep accesses inside it.
+     *
+     * @see CPointer#asByteBuffer(int, int)
+     */
+    public ByteBuffer asByteBuffer(int offset, int length) {
+        boundsCheck(offset, length);
+	return super.asByteBuffer(offset, length);
+    }
+
     /**
      * Indirect the C pointer to <code>malloc</code> space, a la
      * <code>CPointer.getByte</code>.  But this method performs a bounds
@@ -473,8 +1046,91 @@ public class CMalloc extends CPointer {
     /* Size of the malloc'ed space. */
     private int size;
 
-    /* Call the real C malloc. */
+    /* Whether the space came from the pool, and the next block in the
+       same scope. */
+    private boolean pooled;
+    private CMalloc scopeNext;
+
+    /* The pooled blocks allocated while a scope is open. */
+    private static class Scope {
+        Scope outer;
+	CMalloc blocks;
+    }
+
+    private static final ThreadLocal scope = new ThreadLocal();
+
+    /* Frees the space of an autoFree block once the block is unreachable.
+       The reclaimers are kept in a list so that they stay reachable
+       themselves. */
+    private static class Reclaimer extends PhantomReference {
+        final long peer;
+	final int size;
+	final boolean pooled;
+	Reclaimer prev, next;
+
+	Reclaimer(CMalloc m) {
+	    super(m, reclaimed);
+	    peer = m.peer;
+	    size = m.size;
+	    pooled = m.pooled;
+	}
+
+	void unlink() {
+	    synchronized (reclaimed) {
+	        if (prev != null) {
+		    prev.next = next;
+		} else if (reclaimers == this) {
+		    reclaimers = next;
+		} else {
+		    return;	/* not linked */
+		}
+		if (next != null) {
+		    next.prev = prev;
+		}
+		prev = next = null;
+	    }
+	}
+    }
+
+    private static final ReferenceQueue reclaimed = new ReferenceQueue();
+    private static Reclaimer reclaimers;	/* guarded by reclaimed */
+    private Reclaimer reclaimer;
+
+    /* Whether allocations are being recorded. */
+    private static volatile boolean tracking;
+
+    /* Stop automatic freeing before the space is freed explicitly. */
+    private void disarm() {
+        if (reclaimer != null) {
+	    reclaimer.clear();
+	    reclaimer.unlink();
+	    reclaimer = null;
+	}
+    }
+
+    /* The first caller outside this class, as a tag for the registry. */
+    private static String site() {
+        StackTraceElement[] trace = new Throwable().getStackTrace();
+	for (int i = 0; i < trace.length; i++) {
+	    if (!trace[i].getClassName().equals("CMalloc")) {
+	        return trace[i].toString();
+	    }
+	}
+	return "unknown";
+    }
+
+    /* Allocation registry. */
+    private static native void enableTracking(boolean on);
+    private static native void track(long peer, int size, String site);
+
+    /* Call the real C malloc and free. */
     private static native long malloc(int size);
+    private static native void free(long peer);
+
+    /* Pooled allocation. */
+    private static native long poolAlloc(int size);
+    private static native void poolFree(long peer, int size);
+    private static native void freeBulk(long[] peers, int[] sizes, int n);
 
     /* Private to prevent creation of uninitialized malloc space. */
     private CMalloc() {}
@@ -486,6 +1142,38 @@ public class CMalloc extends CPointer {
 	    throw new IndexOutOfBoundsException();
 	}
     }
+
+    /* The same, for accesses that may be longer than an int. */
+    void checkRange(int off, long len) {
+        if (off < 0 || len < 0 || off + len > size) {
+	    throw new IndexOutOfBoundsException();
+	}
+    }
+
+    /* Check the first and last elements of a strided access; the ones in
+       between lie between them. */
+    private void stridedCheck(int off, int stride, int length, int sz) {
+        if (length > 0) {
+	    long last = off + (long)stride * (length - 1);
+	    if (off < 0 || last < 0 ||
+		(long)off + sz > size || last + sz > size) {
+	        throw new IndexOutOfBoundsException();
+	    }
+	}
+    }
+
+    /* Check every offset of a gathered access. */
+    private void gatherCheck(int[] offsets, int length, int sz) {
+        if (length > offsets.length) {
+	    throw new IndexOutOfBoundsException();
+	}
+	for (int i = 0; i < length; i++) {
+	    int off = offsets[i];
+	    if (off < 0 || (long)off + sz > size) {
+	        throw new IndexOutOfBoundsException();
+	    }
+	}
+    }
 }
 
 
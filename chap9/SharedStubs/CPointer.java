@@ -6,6 +6,9 @@
  * See also the LICENSE file in this distribution.
  */
 
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
 /**
  * An abstraction for a C pointer data type.  A CPointer instance represents,
  * on the Java side, a C pointer.  The C pointer could be any <em>type</em>
@@ -214,6 +217,328 @@ public class CPointer {
      */
     public native void copyOut(int bOff, double[] buf, int index, int length);
 
+    /**
+     * Indirect the C pointer, copying <code>length</code> bytes spaced
+     * <code>stride</code> bytes apart <em>from</em> memory pointed to by
+     * the C pointer into the specified array, in one native call.  Element
+     * <em>i</em> is read from byte offset <code>bOff + i * stride</code>;
+     * pass the size of a C struct as <code>stride</code> to pull one field
+     * out of an array of structs.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>byte</code> array into which data is copied
+     * @param index  array index to which data is copied
+     * @param length number of elements that must be copied
+     */
+    public native void getBytes(int bOff, int stride, byte[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> bytes
+     * <em>into</em> memory pointed to by the C pointer, spaced
+     * <code>stride</code> bytes apart, from the specified array.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>byte</code> array from which to copy
+     * @param index  array index from which to start copying
+     * @param length number of elements that must be copied
+     * @see #getBytes(int, int, byte[], int, int)
+     */
+    public native void setBytes(int bOff, int stride, byte[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer at each of a list of byte offsets, copying
+     * the bytes found there into the specified array, in one native
+     * call.  <code>buf[index + i]</code> is read from byte offset
+     * <code>offsets[i]</code>.
+     *
+     * @param offsets byte offsets from pointer of the elements to read
+     * @param buf     <code>byte</code> array into which data is copied
+     * @param index   array index to which data is copied
+     * @param length  number of elements that must be copied
+     */
+    public native void gatherBytes(int[] offsets, byte[] buf, int index,
+				  int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> shorts spaced
+     * <code>stride</code> bytes apart <em>from</em> memory pointed to by
+     * the C pointer into the specified array, in one native call.  Element
+     * <em>i</em> is read from byte offset <code>bOff + i * stride</code>;
+     * pass the size of a C struct as <code>stride</code> to pull one field
+     * out of an array of structs.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>short</code> array into which data is copied
+     * @param index  array index to which data is copied
+     * @param length number of elements that must be copied
+     */
+    public native void getShorts(int bOff, int stride, short[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> shorts
+     * <em>into</em> memory pointed to by the C pointer, spaced
+     * <code>stride</code> bytes apart, from the specified array.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>short</code> array from which to copy
+     * @param index  array index from which to start copying
+     * @param length number of elements that must be copied
+     * @see #getShorts(int, int, short[], int, int)
+     */
+    public native void setShorts(int bOff, int stride, short[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer at each of a list of byte offsets, copying
+     * the shorts found there into the specified array, in one native
+     * call.  <code>buf[index + i]</code> is read from byte offset
+     * <code>offsets[i]</code>.
+     *
+     * @param offsets byte offsets from pointer of the elements to read
+     * @param buf     <code>short</code> array into which data is copied
+     * @param index   array index to which data is copied
+     * @param length  number of elements that must be copied
+     */
+    public native void gatherShorts(int[] offsets, short[] buf, int index,
+				  int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> chars spaced
+     * <code>stride</code> bytes apart <em>from</em> memory pointed to by
+     * the C pointer into the specified array, in one native call.  Element
+     * <em>i</em> is read from byte offset <code>bOff + i * stride</code>;
+     * pass the size of a C struct as <code>stride</code> to pull one field
+     * out of an array of structs.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>char</code> array into which data is copied
+     * @param index  array index to which data is copied
+     * @param length number of elements that must be copied
+     */
+    public native void getChars(int bOff, int stride, char[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> chars
+     * <em>into</em> memory pointed to by the C pointer, spaced
+     * <code>stride</code> bytes apart, from the specified array.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>char</code> array from which to copy
+     * @param index  array index from which to start copying
+     * @param length number of elements that must be copied
+     * @see #getChars(int, int, char[], int, int)
+     */
+    public native void setChars(int bOff, int stride, char[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer at each of a list of byte offsets, copying
+     * the chars found there into the specified array, in one native
+     * call.  <code>buf[index + i]</code> is read from byte offset
+     * <code>offsets[i]</code>.
+     *
+     * @param offsets byte offsets from pointer of the elements to read
+     * @param buf     <code>char</code> array into which data is copied
+     * @param index   array index to which data is copied
+     * @param length  number of elements that must be copied
+     */
+    public native void gatherChars(int[] offsets, char[] buf, int index,
+				  int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> ints spaced
+     * <code>stride</code> bytes apart <em>from</em> memory pointed to by
+     * the C pointer into the specified array, in one native call.  Element
+     * <em>i</em> is read from byte offset <code>bOff + i * stride</code>;
+     * pass the size of a C struct as <code>stride</code> to pull one field
+     * out of an array of structs.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>int</code> array into which data is copied
+     * @param index  array index to which data is copied
+     * @param length number of elements that must be copied
+     */
+    public native void getInts(int bOff, int stride, int[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> ints
+     * <em>into</em> memory pointed to by the C pointer, spaced
+     * <code>stride</code> bytes apart, from the specified array.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>int</code> array from which to copy
+     * @param index  array index from which to start copying
+     * @param length number of elements that must be copied
+     * @see #getInts(int, int, int[], int, int)
+     */
+    public native void setInts(int bOff, int stride, int[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer at each of a list of byte offsets, copying
+     * the ints found there into the specified array, in one native
+     * call.  <code>buf[index + i]</code> is read from byte offset
+     * <code>offsets[i]</code>.
+     *
+     * @param offsets byte offsets from pointer of the elements to read
+     * @param buf     <code>int</code> array into which data is copied
+     * @param index   array index to which data is copied
+     * @param length  number of elements that must be copied
+     */
+    public native void gatherInts(int[] offsets, int[] buf, int index,
+				  int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> longs spaced
+     * <code>stride</code> bytes apart <em>from</em> memory pointed to by
+     * the C pointer into the specified array, in one native call.  Element
+     * <em>i</em> is read from byte offset <code>bOff + i * stride</code>;
+     * pass the size of a C struct as <code>stride</code> to pull one field
+     * out of an array of structs.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>long</code> array into which data is copied
+     * @param index  array index to which data is copied
+     * @param length number of elements that must be copied
+     */
+    public native void getLongs(int bOff, int stride, long[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> longs
+     * <em>into</em> memory pointed to by the C pointer, spaced
+     * <code>stride</code> bytes apart, from the specified array.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>long</code> array from which to copy
+     * @param index  array index from which to start copying
+     * @param length number of elements that must be copied
+     * @see #getLongs(int, int, long[], int, int)
+     */
+    public native void setLongs(int bOff, int stride, long[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer at each of a list of byte offsets, copying
+     * the longs found there into the specified array, in one native
+     * call.  <code>buf[index + i]</code> is read from byte offset
+     * <code>offsets[i]</code>.
+     *
+     * @param offsets byte offsets from pointer of the elements to read
+     * @param buf     <code>long</code> array into which data is copied
+     * @param index   array index to which data is copied
+     * @param length  number of elements that must be copied
+     */
+    public native void gatherLongs(int[] offsets, long[] buf, int index,
+				  int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> floats spaced
+     * <code>stride</code> bytes apart <em>from</em> memory pointed to by
+     * the C pointer into the specified array, in one native call.  Element
+     * <em>i</em> is read from byte offset <code>bOff + i * stride</code>;
+     * pass the size of a C struct as <code>stride</code> to pull one field
+     * out of an array of structs.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>float</code> array into which data is copied
+     * @param index  array index to which data is copied
+     * @param length number of elements that must be copied
+     */
+    public native void getFloats(int bOff, int stride, float[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> floats
+     * <em>into</em> memory pointed to by the C pointer, spaced
+     * <code>stride</code> bytes apart, from the specified array.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>float</code> array from which to copy
+     * @param index  array index from which to start copying
+     * @param length number of elements that must be copied
+     * @see #getFloats(int, int, float[], int, int)
+     */
+    public native void setFloats(int bOff, int stride, float[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer at each of a list of byte offsets, copying
+     * the floats found there into the specified array, in one native
+     * call.  <code>buf[index + i]</code> is read from byte offset
+     * <code>offsets[i]</code>.
+     *
+     * @param offsets byte offsets from pointer of the elements to read
+     * @param buf     <code>float</code> array into which data is copied
+     * @param index   array index to which data is copied
+     * @param length  number of elements that must be copied
+     */
+    public native void gatherFloats(int[] offsets, float[] buf, int index,
+				  int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> doubles spaced
+     * <code>stride</code> bytes apart <em>from</em> memory pointed to by
+     * the C pointer into the specified array, in one native call.  Element
+     * <em>i</em> is read from byte offset <code>bOff + i * stride</code>;
+     * pass the size of a C struct as <code>stride</code> to pull one field
+     * out of an array of structs.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>double</code> array into which data is copied
+     * @param index  array index to which data is copied
+     * @param length number of elements that must be copied
+     */
+    public native void getDoubles(int bOff, int stride, double[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer, copying <code>length</code> doubles
+     * <em>into</em> memory pointed to by the C pointer, spaced
+     * <code>stride</code> bytes apart, from the specified array.
+     *
+     * @param bOff   byte offset from pointer of the first element
+     * @param stride distance in bytes between elements in C memory
+     * @param buf    <code>double</code> array from which to copy
+     * @param index  array index from which to start copying
+     * @param length number of elements that must be copied
+     * @see #getDoubles(int, int, double[], int, int)
+     */
+    public native void setDoubles(int bOff, int stride, double[] buf, int index,
+				int length);
+
+    /**
+     * Indirect the C pointer at each of a list of byte offsets, copying
+     * the doubles found there into the specified array, in one native
+     * call.  <code>buf[index + i]</code> is read from byte offset
+     * <code>offsets[i]</code>.
+     *
+     * @param offsets byte offsets from pointer of the elements to read
+     * @param buf     <code>double</code> array into which data is copied
+     * @param index   array index to which data is copied
+     * @param length  number of elements that must be copied
+     */
+    public native void gatherDoubles(int[] offsets, double[] buf, int index,
+				  int length);
+
     /**
      * Indirect the C pointer as a pointer to <code>byte</code>.  This is
      * equivalent to the expression 
@@ -380,6 +705,50 @@ public class CPointer {
      */
     public native void setString(int offset, String value);
 
+    /**
+     * Wrap the memory pointed to by this C pointer in a direct
+     * <code>ByteBuffer</code>, without copying.  Reads and writes through
+     * the buffer go straight to C memory and need no native method call,
+     * so they are much cheaper than <code>getXXX</code> and
+     * <code>setXXX</code> for scattered accesses.  The buffer uses the
+     * platform's native byte order.
+     * <p>
+     * The buffer does not own the memory: it must not be used once the
+     * memory is freed.
+     *
+     * @param offset byte offset from pointer at which the buffer starts
+     * @param length capacity of the buffer in bytes
+     * @return       a direct <code>ByteBuffer</code> over the memory
+     */
+    public ByteBuffer asByteBuffer(int offset, int length) {
+        if (length < 0) {
+	    throw new IllegalArgumentException("negative length");
+	}
+        return newByteBuffer(offset, length).order(ByteOrder.nativeOrder());
+    }
+
+    /**
+     * Returns a <code>CPointer</code> to the start of the memory
+     * backing a direct <code>ByteBuffer</code>.  The buffer's position
+     * is ignored.
+     * <p>
+     * The <code>CPointer</code> does not keep the buffer reachable; the
+     * caller must, for as long as the pointer is in use.
+     *
+     * @param buf a direct <code>ByteBuffer</code>
+     * @return    a <code>CPointer</code> to the buffer's memory
+     * @exception IllegalArgumentException if <code>buf</code> is not
+     *		  direct
+     */
+    public static native CPointer fromByteBuffer(ByteBuffer buf);
+
+    private native ByteBuffer newByteBuffer(int offset, int length);
+
+    /* Check that len bytes at offset may be accessed; subclasses that
+       know the extent of the memory override this. */
+    void checkRange(int offset, long len) {
+    }
+
     /* Initialize field and method IDs for native methods of this class. */
     private static native int initIDs();
     
@@ -0,0 +1,342 @@
+/*
+ * %W% %E%
+ *
+ * Copyright (c) 1998 Sun Microsystems, Inc. All Rights Reserved.
+ *
+ * See also the LICENSE file in this distribution.
+ */
+
+/**
+ * The layout of a C struct, for reading and writing whole structs in C
+ * memory in a single native method call.
+ * <p>
+ * A layout is described by its field names and a string with one type
+ * letter per field:
+ * <pre>
+ *     B  jbyte (char)       S  jshort (short)    C  jchar (unsigned short)
+ *     I  jint (int)         J  jlong (64 bits)   F  jfloat (float)
+ *     D  jdouble (double)   P  pointer
+ * </pre>
+ * Field offsets, padding and the size of the struct are those the C
+ * compiler would use on this platform.  For example, for
+ * <pre>
+ *     struct point { int x; double y; void *next; };
+ * </pre>
+ * use <code>new CStruct(new String[]{ "x", "y", "next" }, "IDP")</code>.
+ * <p>
+ * A struct is copied either to the fields of a Java object, after binding
+ * the layout to the object's class, or to a pair of primitive arrays.
+ * Either way, arrays of structs are copied with one call too.
+ * <p>
+ * A layout also describes structs passed to and returned from C
+ * functions by value; see <code>byValue</code> and
+ * <code>CFunction.callStruct</code>.
+ *
+ * @see CPointer
+ */
+public class CStruct {
+
+    private final String[] names;
+    private final String types;
+    private final int[] offsets;
+    private final int size;
+    private final int align;
+    private final int nints;
+    private final int nfloats;
+
+    /* Compiled layout, bound to a class if cls is not null.  Also used
+       by CFunction.callStruct. */
+    final long plan;
+    private final Class cls;
+
+    /**
+     * A struct in C memory to be passed by value as an argument of
+     * <code>CFunction.callXXX(Object[])</code>.
+     *
+     * @see CStruct#byValue(CPointer, int)
+     */
+    public static final class Value {
+        private final CStruct layout;
+	private final CPointer ptr;
+	private final int offset;
+
+	private Value(CStruct layout, CPointer ptr, int offset) {
+	    this.layout = layout;
+	    this.ptr = ptr;
+	    this.offset = offset;
+	}
+    }
+
+    private static native void initIDs();
+
+    static {
+        /* CStruct may be loaded before CPointer */
+        System.loadLibrary("disp");
+	initIDs();
+    }
+
+    /* Compile a layout; info receives the offsets, size and alignment. */
+    private static native long compile(String types, String[] names,
+				       Class cls, int[] info);
+
+    private static native void readObject(long plan, long addr, Object obj);
+    private static native void writeObject(long plan, long addr, Object obj);
+    private static native void readObjects(long plan, long addr,
+					   Object[] objs, int index,
+					   int count);
+    private static native void writeObjects(long plan, long addr,
+					    Object[] objs, int index,
+					    int count);
+    private static native void readValues(long plan, long addr, int count,
+					  long[] ints, double[] floats);
+    private static native void writeValues(long plan, long addr, int count,
+					   long[] ints, double[] floats);
+
+    /**
+     * Create a struct layout.
+     *
+     * @param names the field names, in order
+     * @param types one type letter per field
+     * @exception IllegalArgumentException if a type letter is unknown or
+     *		  the number of names does not match
+     */
+    public CStruct(String[] names, String types) {
+        this(names, types, null);
+    }
+
+    private CStruct(String[] names, String types, Class cls) {
+        if (names.length != types.length()) {
+	    throw new IllegalArgumentException("one name per type expected");
+	}
+	int[] info = new int[names.length + 2];
+	this.names = (String[])names.clone();
+	this.types = types;
+	this.cls = cls;
+	plan = compile(types, this.names, cls, info);
+	offsets = new int[names.length];
+	System.arraycopy(info, 0, offsets, 0, names.length);
+	size = info[names.length];
+	align = info[names.length + 1];
+
+	int f = 0;
+	for (int i = 0; i < types.length(); i++) {
+	    char t = types.charAt(i);
+	    if (t == 'F' || t == 'D') {
+	        f++;
+	    }
+	}
+	nfloats = f;
+	nints = types.length() - f;
+    }
+
+    /**
+     * Returns this layout bound to a Java class.  Each field of the struct
+     * is copied to and from the field of the class with the same name,
+     * which must have the matching Java type; pointers are held in
+     * <code>long</code> fields.
+     *
+     * @param cls the class to bind to
+     * @return    a bound layout
+     * @exception NoSuchFieldError if the class lacks a field
+     */
+    public CStruct bind(Class cls) {
+        return new CStruct(names, types, cls);
+    }
+
+    /**
+     * Returns the size of the struct in bytes, including trailing padding;
+     * it is also the distance between elements of an array of structs.
+     *
+     * @return the size of the struct
+     */
+    public int size() {
+        return size;
+    }
+
+    /**
+     * Returns the alignment of the struct in bytes.
+     *
+     * @return the alignment of the struct
+     */
+    public int alignment() {
+        return align;
+    }
+
+    /**
+     * Returns the byte offset of a field, for use with the
+     * <code>getXXX</code> and <code>setXXX</code> methods of
+     * <code>CPointer</code>.
+     *
+     * @param  name the field name
+     * @return      the offset of the field from the start of the struct
+     * @exception IllegalArgumentException if there is no such field
+     */
+    public int offsetOf(String name) {
+        for (int i = 0; i < names.length; i++) {
+	    if (names[i].equals(name)) {
+	        return offsets[i];
+	    }
+	}
+	throw new IllegalArgumentException("no field " + name);
+    }
+
+    /**
+     * Returns an argument that passes the struct at
+     * <code>ptr + offset</code> to a C function by value.  The struct is
+     * copied when the function is called, not now.  For example, with
+     * <code>layout</code> describing <code>struct timespec</code>:
+     * <pre>
+     *     nanosleep.callInt(new Object[]{ layout.byValue(ts, 0), null });
+     * </pre>
+     * would pass <code>*ts</code> itself rather than a pointer to it.
+     * Structs cannot be passed by value on SPARC.
+     *
+     * @param ptr    pointer to C memory
+     * @param offset byte offset of the struct from <code>ptr</code>
+     * @return       an argument for <code>CFunction.callXXX</code>
+     * @see CFunction#callStruct(CStruct, CPointer, Object[])
+     */
+    public Value byValue(CPointer ptr, int offset) {
+        ptr.checkRange(offset, size);
+	return new Value(this, ptr, offset);
+    }
+
+    /**
+     * Copy the struct at <code>ptr + offset</code> into the fields of an
+     * object of the bound class.
+     *
+     * @param ptr    pointer to C memory
+     * @param offset byte offset of the struct from <code>ptr</code>
+     * @param obj    the object to fill in
+     * @exception IllegalStateException if the layout is not bound
+     */
+    public void read(CPointer ptr, int offset, Object obj) {
+        checkObject(obj);
+	ptr.checkRange(offset, size);
+	readObject(plan, ptr.peer + offset, obj);
+    }
+
+    /**
+     * Copy the fields of an object of the bound class into the struct at
+     * <code>ptr + offset</code>.
+     *
+     * @param ptr    pointer to C memory
+     * @param offset byte offset of the struct from <code>ptr</code>
+     * @param obj    the object to copy from
+     * @exception IllegalStateException if the layout is not bound
+     */
+    public void write(CPointer ptr, int offset, Object obj) {
+        checkObject(obj);
+	ptr.checkRange(offset, size);
+	writeObject(plan, ptr.peer + offset, obj);
+    }
+
+    /**
+     * Copy an array of <code>count</code> structs starting at
+     * <code>ptr + offset</code> into objects of the bound class.
+     *
+     * @param ptr    pointer to C memory
+     * @param offset byte offset of the first struct from <code>ptr</code>
+     * @param objs   the objects to fill in
+     * @param index  index in <code>objs</code> of the first object
+     * @param count  number of structs
+     * @exception IllegalStateException if the layout is not bound
+     */
+    public void readArray(CPointer ptr, int offset, Object[] objs,
+			  int index, int count) {
+        checkObjects(objs, index, count);
+	ptr.checkRange(offset, (long)size * count);
+	readObjects(plan, ptr.peer + offset, objs, index, count);
+    }
+
+    /**
+     * Copy objects of the bound class into an array of <code>count</code>
+     * structs starting at <code>ptr + offset</code>.
+     *
+     * @param ptr    pointer to C memory
+     * @param offset byte offset of the first struct from <code>ptr</code>
+     * @param objs   the objects to copy from
+     * @param index  index in <code>objs</code> of the first object
+     * @param count  number of structs
+     * @exception IllegalStateException if the layout is not bound
+     */
+    public void writeArray(CPointer ptr, int offset, Object[] objs,
+			   int index, int count) {
+        checkObjects(objs, index, count);
+	ptr.checkRange(offset, (long)size * count);
+	writeObjects(plan, ptr.peer + offset, objs, index, count);
+    }
+
+    /**
+     * Copy an array of <code>count</code> structs starting at
+     * <code>ptr + offset</code> into primitive arrays.  The integer and
+     * pointer fields of each struct are stored in order in
+     * <code>ints</code>, and its floating point fields in
+     * <code>floats</code>, followed by those of the next struct.  Either
+     * array may be <code>null</code> if the struct has no fields of that
+     * kind.  The layout need not be bound.
+     *
+     * @param ptr    pointer to C memory
+     * @param offset byte offset of the first struct from <code>ptr</code>
+     * @param count  number of structs
+     * @param ints   receives the integer and pointer fields
+     * @param floats receives the floating point fields
+     */
+    public void read(CPointer ptr, int offset, int count,
+		     long[] ints, double[] floats) {
+        checkValues(count, ints, floats);
+	ptr.checkRange(offset, (long)size * count);
+	readValues(plan, ptr.peer + offset, count, ints, floats);
+    }
+
+    /**
+     * Copy primitive arrays, laid out as for
+     * <code>read(CPointer, int, int, long[], double[])</code>, into an
+     * array of <code>count</code> structs starting at
+     * <code>ptr + offset</code>.  Integer fields narrower than 64 bits
+     * take the low-order bits of their values.
+     *
+     * @param ptr    pointer to C memory
+     * @param offset byte offset of the first struct from <code>ptr</code>
+     * @param count  number of structs
+     * @param ints   the integer and pointer fields
+     * @param floats the floating point fields
+     */
+    public void write(CPointer ptr, int offset, int count,
+		      long[] ints, double[] floats) {
+        checkValues(count, ints, floats);
+	ptr.checkRange(offset, (long)size * count);
+	writeValues(plan, ptr.peer + offset, count, ints, floats);
+    }
+
+    private void checkObject(Object obj) {
+        if (cls == null) {
+	    throw new IllegalStateException("layout is not bound to a class");
+	}
+	if (!cls.isInstance(obj)) {
+	    throw new ClassCastException();
+	}
+    }
+
+    private void checkObjects(Object[] objs, int index, int count) {
+        if (cls == null) {
+	    throw new IllegalStateException("layout is not bound to a class");
+	}
+	if (index < 0 || count < 0 || index > objs.length - count) {
+	    throw new IndexOutOfBoundsException();
+	}
+	for (int i = index; i < index + count; i++) {
+	    if (!cls.isInstance(objs[i])) {
+	        throw new ClassCastException();
+	    }
+	}
+    }
+
+    private void checkValues(int count, long[] ints, double[] floats) {
+        if (count < 0 ||
+	    (nints > 0 && ints.length < (long)nints * count) ||
+	    (nfloats > 0 && floats.length < (long)nfloats * count)) {
+	    throw new IndexOutOfBoundsException();
+	}
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * %W% %E%
+ *
+ * Copyright (c) 1998 Sun Microsystems, Inc. All Rights Reserved.
+ *
+ * See also the LICENSE file in this distribution.
+ */
+
+/**
+ * Measures the cost of a shared stub call as a function of the number
+ * of arguments passed.
+ * <p>
+ * The function called is C's <code>snprintf(NULL, 0, "", ...)</code>,
+ * which does no work with its trailing arguments, so the time reported
+ * is almost entirely argument marshalling and dispatch.  Each argument
+ * count from 0 to 128 is timed both through
+ * <code>callInt(Object[])</code> and through a <code>CFunction</code>
+ * bound to a signature.  Calls with more than 32 arguments are
+ * marshalled in the per-thread scratch arena rather than on the C
+ * stack, which shows up as a small step in the timings.
+ *
+ * @see CFunction
+ */
+public class CallBench {
+
+    private static final int MAX_ARGS = 128;
+
+    /**
+     * Runs the benchmark and prints one line per argument count: the
+     * count, then nanoseconds per call through <code>Object[]</code>
+     * and through a bound signature.
+     *
+     * @param args optional number of calls to time per argument count
+     *             (default 20000)
+     */
+    public static void main(String[] args) {
+        int iters = args.length > 0 ? Integer.parseInt(args[0]) : 20000;
+
+	String osName = System.getProperty("os.name");
+	String libc, fname;
+	if (osName.equals("SunOS") || osName.equals("Solaris")) {
+	    libc = "libc.so";
+	    fname = "snprintf";
+	} else if (osName.equals("Linux")) {
+	    libc = "libc.so.6";
+	    fname = "snprintf";
+	} else {
+	    libc = "msvcrt.dll";		  // Win32
+	    fname = "_snprintf";
+	}
+
+	/* An empty format string in C memory for the bound calls. */
+	CMalloc fmt = new CMalloc(1);
+	try {
+	    fmt.setByte(0, (byte)0);
+	    System.out.println("nargs\tObject[] ns\tbound ns");
+	    for (int n = 0; n <= MAX_ARGS; n++) {
+	        CFunction boxed = new CFunction(libc, fname);
+		CFunction bound = new CFunction(libc, fname);
+		bound.bind(signature(n));
+
+		Object[] oargs = new Object[3 + n];
+		oargs[0] = null;
+		oargs[1] = new Integer(0);
+		oargs[2] = "";
+		long[] iargs = new long[3 + n];
+		iargs[2] = fmt.peer;
+		for (int i = 0; i < n; i++) {
+		    oargs[3 + i] = new Integer(i);
+		    iargs[3 + i] = i;
+		}
+
+		/* Warm up both paths before timing them. */
+		time(boxed, oargs, iters / 10);
+		time(bound, iargs, iters / 10);
+		long tBoxed = time(boxed, oargs, iters);
+		long tBound = time(bound, iargs, iters);
+		System.out.println(n + "\t" + tBoxed / iters + "\t\t" +
+				   tBound / iters);
+	    }
+	} finally {
+	    fmt.free();
+	}
+    }
+
+    /* "(P,P,P,I,...,I)I": buffer, size, format, then n ints. */
+    private static String signature(int n) {
+        StringBuffer sb = new StringBuffer("(P,P,P");
+	for (int i = 0; i < n; i++) {
+	    sb.append(",I");
+	}
+	return sb.append(")I").toString();
+    }
+
+    private static long time(CFunction f, Object[] args, int iters) {
+        long start = System.nanoTime();
+	for (int i = 0; i < iters; i++) {
+	    f.callInt(args);
+	}
+	return System.nanoTime() - start;
+    }
+
+    private static long time(CFunction f, long[] iargs, int iters) {
+        long start = System.nanoTime();
+	for (int i = 0; i < iters; i++) {
+	    f.callInt(iargs, null);
+	}
+	return System.nanoTime() - start;
+    }
+}
@@ -49,6 +49,9 @@ public class Main {
 	if (osName.equals("SunOS") || osName.equals("Solaris")) {
 	    libc = "libc.so";
 	    libm = "libm.so";
+	} else if (osName.equals("Linux")) {
+	    libc = "libc.so.6";
+	    libm = "libm.so.6";
 	} else {
 	    libc = libm = "msvcrt.dll";		  // Win32
 	}
@@ -117,7 +120,13 @@ public class Main {
 	double dres = sin.callDouble(new Object[]{new Double(2.0) });
 	System.out.println("\nC's  sin(2.0) = " + dres);
 	System.out.println("Math.sin(2.0) = " + Math.sin(2.0));
-	
+
+	/* The same call through a bound signature.  The argument types are
+	   resolved once, and the arguments are passed without boxing. */
+	sin.bind("(D)D");
+	dres = sin.callDouble(null, new double[]{ 2.0 });
+	System.out.println("C's  sin(2.0) = " + dres + " (bound)");
+
 
 	/* clock().  Takes no arguments. */
 	CFunction clock = new CFunction(libc, "clock");
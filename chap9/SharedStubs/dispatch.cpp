@@ -22,31 +22,87 @@
 
 #ifdef SOLARIS2
 #include <dlfcn.h>
+#include <atomic.h>
+#include <pthread.h>
 #define LOAD_LIBRARY(name) dlopen(name, RTLD_LAZY)
 #define FIND_ENTRY(lib, name) dlsym(lib, name)
+#define UNLOAD_LIBRARY(lib) dlclose(lib)
+#define THREAD_LOCAL __thread
+#define THREAD_KEY pthread_key_t
+#define THREAD_KEY_CREATE(k, fn) (pthread_key_create(&(k), fn) == 0)
+#define THREAD_KEY_SET(k, v) pthread_setspecific(k, v)
+#define THREAD_EXIT_CALL
+#define MEMORY_BARRIER() membar_producer()
+#define ATOMIC_INC(p) atomic_inc_64((volatile uint64_t *)(p))
+#define ATOMIC_ADD(p, n) atomic_add_64((volatile uint64_t *)(p), n)
+#endif
+
+#ifdef LINUX
+#include <dlfcn.h>
+#include <pthread.h>
+#define LOAD_LIBRARY(name) dlopen(name, RTLD_LAZY)
+#define FIND_ENTRY(lib, name) dlsym(lib, name)
+#define UNLOAD_LIBRARY(lib) dlclose(lib)
+#define THREAD_LOCAL __thread
+#define THREAD_KEY pthread_key_t
+#define THREAD_KEY_CREATE(k, fn) (pthread_key_create(&(k), fn) == 0)
+#define THREAD_KEY_SET(k, v) pthread_setspecific(k, v)
+#define THREAD_EXIT_CALL
+#define MEMORY_BARRIER() __sync_synchronize()
+#define ATOMIC_INC(p) __sync_fetch_and_add(p, 1)
+#define ATOMIC_ADD(p, n) __sync_fetch_and_add(p, n)
+/* dispatch_amd64.c generates callback trampolines */
+#define DISPATCH_CALLBACKS
 #endif
 
 #ifdef WIN32
 #include <windows.h>
 #define LOAD_LIBRARY(name) LoadLibrary(name)
-#define FIND_ENTRY(lib, name) GetProcAddress(lib, name)
+#define FIND_ENTRY(lib, name) GetProcAddress((HMODULE)(lib), name)
+#define UNLOAD_LIBRARY(lib) FreeLibrary((HMODULE)(lib))
+#define THREAD_LOCAL __declspec(thread)
+#define THREAD_KEY DWORD
+#define THREAD_KEY_CREATE(k, fn) (((k) = FlsAlloc(fn)) != FLS_OUT_OF_INDEXES)
+#define THREAD_KEY_SET(k, v) FlsSetValue(k, v)
+#define THREAD_EXIT_CALL WINAPI
+#define MEMORY_BARRIER() MemoryBarrier()
+#define ATOMIC_INC(p) InterlockedIncrement64((volatile LONGLONG *)(p))
+#define ATOMIC_ADD(p, n) InterlockedExchangeAdd64((volatile LONGLONG *)(p), n)
 #endif
 
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DISPATCH_SSE2
+#endif
 
 #include <jni.h>
 
 #include "CPointer.h"
 #include "CFunction.h"
 #include "CMalloc.h"
+#include "CArena.h"
+#include "CStruct.h"
+#include "CCallback.h"
 
 /* Global references to frequently used classes and objects */
 static jclass Class_String;
 static jclass Class_Integer;
 static jclass Class_Float;
 static jclass Class_Double;
+static jclass Class_Long;
+static jclass Class_Short;
+static jclass Class_Byte;
+static jclass Class_Character;
+static jclass Class_Boolean;
 static jclass Class_CPointer;
+static jclass Class_CFunction;
+static jclass Class_CStructValue;	/* NULL until CStruct is loaded */
+static jclass Class_CCallback;
+static jclass Class_Arrays[8];		/* indexed by array_kind */
 
 /* Cached field and method IDs */
 static jmethodID MID_String_getBytes;
@@ -55,14 +111,108 @@ static jmethodID MID_String_init;
 static jfieldID FID_Integer_value;
 static jfieldID FID_Float_value;
 static jfieldID FID_Double_value;
+static jfieldID FID_Long_value;
+static jfieldID FID_Short_value;
+static jfieldID FID_Byte_value;
+static jfieldID FID_Character_value;
+static jfieldID FID_Boolean_value;
 static jfieldID FID_CPointer_peer;
 static jfieldID FID_CFunction_conv;
+static jfieldID FID_CFunction_sig;
+static jfieldID FID_CFunction_critical;
+static jfieldID FID_CStruct_plan;
+static jfieldID FID_CStructValue_layout;
+static jfieldID FID_CStructValue_ptr;
+static jfieldID FID_CStructValue_offset;
+static jfieldID FID_CCallback_slot;
+
+/* How the platform encoding relates to UTF-8, set up in initIDs */
+static enum {
+    ENC_OTHER,			/* unknown; always call String.getBytes */
+    ENC_ASCII,			/* ASCII strings can be copied as is */
+    ENC_UTF8			/* UTF-8, the JNI can convert directly */
+} native_encoding;
+
+/*
+ * Per-thread scratch arena for C strings and other temporaries that
+ * only live for the duration of one native method call.  Memory is
+ * handed out by bumping a pointer and given back all at once by
+ * restoring a mark taken on entry.  The first chunk is thread-local
+ * storage and overflow chunks are kept for reuse, so once a thread has
+ * warmed up, calls do no heap allocation at all.  Overflow chunks are
+ * freed when the thread exits.
+ */
+typedef struct scratch_chunk {
+    struct scratch_chunk *next;	/* next chunk, kept for reuse */
+    size_t size;		/* usable bytes after the header */
+} scratch_chunk_t;
+
+typedef struct {
+    scratch_chunk_t *chunk;	/* chunk being allocated from */
+    size_t used;		/* bytes used in it */
+    size_t depth;		/* bytes in use on this thread */
+} scratch_mark_t;
+
+/* Size of the thread-local chunk; see CFunction.getScratchHighWater */
+#ifndef SCRATCH_SIZE
+#define SCRATCH_SIZE 4096
+#endif
+#define SCRATCH_HDR ((sizeof(scratch_chunk_t) + 15) & ~15)
+
+static THREAD_LOCAL union {
+    scratch_chunk_t hdr;
+    double align;
+    char bytes[SCRATCH_SIZE];
+} scratch0;
+static THREAD_LOCAL scratch_mark_t scratch;
+static size_t scratch_high_water;	/* largest depth on any thread */
+
+/* Frees a thread's overflow chunks when it exits; set in JNI_OnLoad */
+static THREAD_KEY scratch_key;
+static int scratch_keyed;
+
+/*
+ * Process-wide cache of resolved symbols, keyed by library and symbol
+ * name.  Lookups walk a hash chain without locking; entries are added
+ * and removed under the CFunction class monitor, and a new entry is
+ * fully written before it is linked in.  An entry removed by
+ * unloadLibrary is never freed, because another thread may still be
+ * walking past it; unloading is rare and an entry is small.
+ */
+typedef struct symbol {
+    struct symbol *next;	/* next in hash chain */
+    void *func;			/* the resolved address */
+    size_t liblen;		/* key is "lib\0sym\0" */
+    char key[1];
+} symbol_t;
+
+/* A loaded library, reused by every symbol found in it */
+typedef struct library {
+    struct library *next;
+    void *handle;
+    char name[1];
+} library_t;
+
+#define SYM_BUCKETS 256
+
+static symbol_t * volatile symbols[SYM_BUCKETS];
+static library_t *libraries;	/* guarded by the class monitor */
+static volatile jlong sym_hits;
+static volatile jlong sym_misses;
 
 /* Forward declarations */
 static void JNU_ThrowByName(JNIEnv *env, const char *name, const char *msg);
+#ifdef JNI_BOOK
 static char * JNU_GetStringNativeChars(JNIEnv *env, jstring jstr);
+#endif
+static void * scratch_alloc(size_t size);
+static char * getStringScratchChars(JNIEnv *env, jstring jstr);
 static jstring JNU_NewStringNative(JNIEnv *env, const char *str);
 static jobject makeCPointer(JNIEnv *env, void *p);
+typedef struct clayout clayout_t;
+static clayout_t * struct_value(JNIEnv *env, jobject val, void **addrP,
+				jint *sizeP);
+static void struct_words(clayout_t *l, char *types, int nwords);
 
 
 /********************************************************************/
@@ -76,9 +226,17 @@ typedef enum {
     TY_FLOAT,
     TY_DOUBLE,
     TY_DOUBLE2,
-    TY_STRING
+    TY_STRING,
+    TY_SWORD_INT,		/* word of a struct, holding integer data */
+    TY_SWORD_FLT,		/* word of a struct, holding only floats */
+    TY_STRUCT,			/* struct result; resP is an sret_t * */
+    TY_LONG,
+    TY_LONG2			/* second word of a long, if any */
 } ty_t;
 
+/* Flags the first word of each struct argument */
+#define TY_SFIRST 0x40
+
 /* represent a machine word */
 typedef union {
     jint i;
@@ -86,6 +244,18 @@ typedef union {
     void *p;
 } word_t;
 
+/* Where a TY_STRUCT result goes.  The backend either hands dest to the
+ * function as the hidden result pointer or copies the returned
+ * registers there, according to the ABI; types describes the words of
+ * structs of up to two words, as for struct arguments.
+ */
+typedef struct {
+    void *dest;
+    int size;
+    int nwords;
+    char types[2];
+} sret_t;
+
 /* A CPU-dependent assembly routine that passes the arguments to C
  * stack and invoke the function.
  */
@@ -98,6 +268,115 @@ asm_dispatch(void *func,
 	     word_t *resP,
 	     int conv);
 
+#ifdef DISPATCH_THUNKS
+/* A generated call thunk for one signature; see dispatch_amd64.c */
+typedef void (*thunk_t)(void *func, word_t *args, word_t *resP);
+
+extern "C" void *
+asm_make_thunk(int nwords, char *arg_types, int res_type);
+#endif
+
+#ifdef DISPATCH_CALLBACKS
+/* A trampoline that calls callback_invoke for the slot */
+extern "C" void *
+asm_make_callback(void *slot);
+#endif
+
+/* Calls with up to this many arguments are marshalled in buffers on
+ * the C stack; longer ones take their buffers from the scratch arena.
+ * There is no upper limit.
+ */
+#define INLINE_NARGS 32
+
+/*
+ * A primitive array argument.  Its elements are only fetched once all
+ * other arguments have been converted, since no other JNI function may
+ * be called while arrays are pinned with GetPrimitiveArrayCritical.
+ */
+typedef struct {
+    jarray arr;			/* local ref, deleted after the call */
+    void *elems;		/* passed to the function */
+    int word;			/* index of its argument word */
+    int kind;			/* index in Class_Arrays */
+} array_arg_t;
+
+static const char array_sigs[8][3] = {
+    "[Z", "[B", "[C", "[S", "[I", "[J", "[F", "[D"
+};
+
+/* Index of obj's class in Class_Arrays, or -1 if not a primitive array */
+static int
+array_kind(JNIEnv *env, jobject obj)
+{
+    int k;
+    for (k = 0; k < 8; k++) {
+        if (env->IsInstanceOf(obj, Class_Arrays[k])) {
+	    return k;
+	}
+    }
+    return -1;
+}
+
+/* Fetch the elements of an array argument, pinned or copied */
+static void *
+array_get(JNIEnv *env, array_arg_t *a, jboolean critical)
+{
+    jarray arr = a->arr;
+
+    if (critical) {
+        return env->GetPrimitiveArrayCritical(arr, 0);
+    }
+    switch (a->kind) {
+    case 0: return env->GetBooleanArrayElements((jbooleanArray)arr, 0);
+    case 1: return env->GetByteArrayElements((jbyteArray)arr, 0);
+    case 2: return env->GetCharArrayElements((jcharArray)arr, 0);
+    case 3: return env->GetShortArrayElements((jshortArray)arr, 0);
+    case 4: return env->GetIntArrayElements((jintArray)arr, 0);
+    case 5: return env->GetLongArrayElements((jlongArray)arr, 0);
+    case 6: return env->GetFloatArrayElements((jfloatArray)arr, 0);
+    default: return env->GetDoubleArrayElements((jdoubleArray)arr, 0);
+    }
+}
+
+/* Release the elements of an array argument, copying back any changes */
+static void
+array_release(JNIEnv *env, array_arg_t *a, jboolean critical)
+{
+    jarray arr = a->arr;
+    void *p = a->elems;
+
+    if (critical) {
+        env->ReleasePrimitiveArrayCritical(arr, p, 0);
+	return;
+    }
+    switch (a->kind) {
+    case 0:
+        env->ReleaseBooleanArrayElements((jbooleanArray)arr, (jboolean *)p, 0);
+	break;
+    case 1:
+        env->ReleaseByteArrayElements((jbyteArray)arr, (jbyte *)p, 0);
+	break;
+    case 2:
+        env->ReleaseCharArrayElements((jcharArray)arr, (jchar *)p, 0);
+	break;
+    case 3:
+        env->ReleaseShortArrayElements((jshortArray)arr, (jshort *)p, 0);
+	break;
+    case 4:
+        env->ReleaseIntArrayElements((jintArray)arr, (jint *)p, 0);
+	break;
+    case 5:
+        env->ReleaseLongArrayElements((jlongArray)arr, (jlong *)p, 0);
+	break;
+    case 6:
+        env->ReleaseFloatArrayElements((jfloatArray)arr, (jfloat *)p, 0);
+	break;
+    default:
+        env->ReleaseDoubleArrayElements((jdoubleArray)arr, (jdouble *)p, 0);
+	break;
+    }
+}
+
 /* invoke the real native function */
 static void
 dispatch(JNIEnv *env,
@@ -106,18 +385,31 @@ dispatch(JNIEnv *env,
 	 ty_t res_ty,
 	 jvalue *resP)
 {
-#define MAX_NARGS 32
-    int i, nargs, nwords;
+    int i, nargs, nwords, cap;
     void *func;
-    char argTypes[MAX_NARGS];
-    word_t c_args[MAX_NARGS * 2];
+    char argTypes_buf[INLINE_NARGS * 2];
+    word_t c_args_buf[INLINE_NARGS * 2];
+    array_arg_t arrays_buf[INLINE_NARGS];
+    char *argTypes = argTypes_buf;
+    word_t *c_args = c_args_buf;
+    array_arg_t *arrays = arrays_buf;
+    int narrays = 0, npinned = 0, kind;
+    jboolean critical = JNI_FALSE, out_of_memory = JNI_FALSE;
     int conv;
+    scratch_mark_t mark = scratch;
 
+    /* a double may take two words */
     nargs = env->GetArrayLength(arr);
-    if (nargs > MAX_NARGS) {
-        JNU_ThrowByName(env, "java/lang/IllegalArgumentException",
-		    "too many arguments");
-	return;
+    cap = INLINE_NARGS * 2;
+    if (nargs > INLINE_NARGS) {
+        cap = nargs * 2;
+        argTypes = (char *)scratch_alloc(cap);
+	c_args = (word_t *)scratch_alloc(cap * sizeof(word_t));
+	arrays = (array_arg_t *)scratch_alloc(nargs * sizeof(array_arg_t));
+	if (argTypes == NULL || c_args == NULL || arrays == NULL) {
+	    JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	    goto cleanup;
+	}
     }
     func = (void *)env->GetLongField(self, FID_CPointer_peer);
 
@@ -135,7 +427,8 @@ dispatch(JNIEnv *env,
 	        (void *)env->GetLongField(arg, FID_CPointer_peer);
 	    argTypes[nwords++] = TY_CPTR;
 	} else if (env->IsInstanceOf(arg, Class_String)) {
-	    if ((c_args[nwords].p = JNU_GetStringNativeChars(env, (jstring)arg)) == 0) {
+	    /* lives in the scratch arena until cleanup */
+	    if ((c_args[nwords].p = getStringScratchChars(env, (jstring)arg)) == 0) {
 	        goto cleanup;
 	    }
 	    argTypes[nwords++] = TY_STRING;
@@ -151,6 +444,75 @@ dispatch(JNIEnv *env,
 	    argTypes[nwords + 1] = TY_DOUBLE2;
 	    /* make sure things work on 64-bit machines */
 	    nwords += sizeof(jdouble) / sizeof(word_t);
+	} else if (env->IsInstanceOf(arg, Class_Long)) {
+	    /* like a double, two words on 32-bit machines */
+	    *(jlong *)(c_args + nwords) =
+	        env->GetLongField(arg, FID_Long_value);
+	    argTypes[nwords] = TY_LONG;
+	    argTypes[nwords + 1] = TY_LONG2;
+	    nwords += sizeof(jlong) / sizeof(word_t);
+	} else if (env->IsInstanceOf(arg, Class_Short)) {
+	    /* narrower types are promoted to int, as C would */
+	    c_args[nwords].i =
+	        env->GetShortField(arg, FID_Short_value);
+	    argTypes[nwords++] = TY_INTEGER;
+	} else if (env->IsInstanceOf(arg, Class_Byte)) {
+	    c_args[nwords].i =
+	        env->GetByteField(arg, FID_Byte_value);
+	    argTypes[nwords++] = TY_INTEGER;
+	} else if (env->IsInstanceOf(arg, Class_Character)) {
+	    c_args[nwords].i =
+	        env->GetCharField(arg, FID_Character_value);
+	    argTypes[nwords++] = TY_INTEGER;
+	} else if (env->IsInstanceOf(arg, Class_Boolean)) {
+	    c_args[nwords].i =
+	        env->GetBooleanField(arg, FID_Boolean_value) ? 1 : 0;
+	    argTypes[nwords++] = TY_INTEGER;
+	} else if ((kind = array_kind(env, arg)) >= 0) {
+	    /* the elements are fetched below; keep the local ref */
+	    arrays[narrays].arr = (jarray)arg;
+	    arrays[narrays].word = nwords;
+	    arrays[narrays++].kind = kind;
+	    c_args[nwords].p = NULL;
+	    argTypes[nwords++] = TY_CPTR;
+	    continue;
+	} else if (Class_CStructValue != NULL &&
+		   env->IsInstanceOf(arg, Class_CStructValue)) {
+#ifdef SOLARIS2
+	    /* SPARC passes structs as pointers to copies, not done yet */
+	    JNU_ThrowByName(env, "java/lang/UnsupportedOperationException",
+			    "structs by value");
+	    goto cleanup;
+#else
+	    void *addr;
+	    jint size;
+	    clayout_t *l = struct_value(env, arg, &addr, &size);
+	    int n = (size + sizeof(word_t) - 1) / sizeof(word_t);
+
+	    if (l == NULL) {
+	        goto cleanup;
+	    }
+
+	    /* the struct, and two words for each argument after it */
+	    if (nwords + n + (nargs - i - 1) * 2 > cap) {
+	        char *types = argTypes;
+		word_t *words = c_args;
+	        cap = (nwords + n + (nargs - i - 1) * 2) * 2;
+		argTypes = (char *)scratch_alloc(cap);
+		c_args = (word_t *)scratch_alloc(cap * sizeof(word_t));
+		if (argTypes == NULL || c_args == NULL) {
+		    JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+		    goto cleanup;
+		}
+		memcpy(argTypes, types, nwords);
+		memcpy(c_args, words, nwords * sizeof(word_t));
+	    }
+	    /* copied whole, padding included; the tail is zeroed */
+	    memset(c_args + nwords, 0, n * sizeof(word_t));
+	    memcpy(c_args + nwords, addr, size);
+	    struct_words(l, argTypes + nwords, n);
+	    nwords += n;
+#endif
 	} else {
 	    JNU_ThrowByName(env, "java/lang/IllegalArgumentException",
 			"unrecognized argument type");
@@ -160,665 +522,2991 @@ dispatch(JNIEnv *env,
     }
 
     conv = env->GetIntField(self, FID_CFunction_conv);
-    asm_dispatch(func, nwords, argTypes, c_args, res_ty, (word_t *)resP, conv);
+    critical = env->GetBooleanField(self, FID_CFunction_critical);
+
+    /* last, since no JNI calls are allowed while pinned */
+    for (; npinned < narrays; npinned++) {
+        array_arg_t *a = &arrays[npinned];
+	if ((a->elems = array_get(env, a, critical)) == NULL) {
+	    /* can't throw until the others are released */
+	    out_of_memory = JNI_TRUE;
+	    break;
+	}
+	c_args[a->word].p = a->elems;
+    }
+    if (!out_of_memory) {
+        asm_dispatch(func, nwords, argTypes, c_args, res_ty,
+		     (word_t *)resP, conv);
+    }
 
 cleanup:
-    for (i = 0; i < nwords; i++) {
-        if (argTypes[i] == TY_STRING) {
-	    free(c_args[i].p);
-	}
+    while (npinned > 0) {
+        array_release(env, &arrays[--npinned], critical);
+    }
+    if (out_of_memory && !env->ExceptionCheck()) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
     }
+    while (narrays > 0) {
+        env->DeleteLocalRef(arrays[--narrays].arr);
+    }
+    /* restore rather than reset, the call may have come back in here */
+    scratch = mark;
     return;
 }
 
 /*
- * Class:     CFunction
- * Method:    initIDs
- * Signature: ()V
+ * A precompiled call signature.  The argument types are resolved once,
+ * when a CFunction is bound to a signature, so that the typed callXXX
+ * entry points can move primitive arguments straight into the word
+ * array without inspecting any Java objects.
+ *
+ * Signatures are interned: every CFunction bound to the same signature
+ * string shares one callsig_t, which lives as long as the library.
  */
-JNIEXPORT void JNICALL 
-Java_CFunction_initIDs(JNIEnv *env, jclass cls)
+typedef struct callsig {
+    struct callsig *next;		/* next interned signature */
+    char *text;			/* signature string, e.g. "(I,P,D)I" */
+    int nargs;			/* number of arguments */
+    int nwords;			/* number of words they occupy */
+    int nints;			/* arguments taken from the long[] */
+    int nfloats;		/* arguments taken from the double[] */
+    ty_t res_ty;		/* return type */
+    jboolean is_void;		/* return type is 'V' */
+    char *kinds;		/* per argument: TY_INTEGER, TY_CPTR, ... */
+    char *argTypes;		/* per word, as passed to asm_dispatch */
+    void *thunk;		/* generated call thunk, or NULL */
+} callsig_t;
+
+static callsig_t *sigs;		/* interned signatures */
+
+/* Map a signature type code to the type it is passed as */
+static int
+sig_code(char c, ty_t *tyP)
 {
-    FID_CFunction_conv = env->GetFieldID(cls, "conv", "I");
+    switch (c) {
+    case 'I': *tyP = TY_INTEGER; return 1;
+    case 'F': *tyP = TY_FLOAT; return 1;
+    case 'D': *tyP = TY_DOUBLE; return 1;
+    case 'P': *tyP = TY_CPTR; return 1;
+    case 'J': *tyP = TY_LONG; return 1;
+    }
+    return 0;
 }
 
-/*
- * Class:     CFunction
- * Method:    callCPointer
- * Signature: ([Ljava/lang/Object;)LCPointer;
+/* Parse a signature of the form "(I,P,D)I" into a new callsig_t. Returns
+ * NULL, with an exception pending, if the signature is malformed.
  */
-JNIEXPORT jobject JNICALL 
-Java_CFunction_callCPointer(JNIEnv *env, jobject self, jobjectArray arr)
+static callsig_t *
+sig_parse(JNIEnv *env, const char *text)
 {
-    jvalue result;
-    dispatch(env, self, arr, TY_CPTR, &result);
-    if (env->ExceptionOccurred()) {
-        return NULL;
+    const char *s;
+    callsig_t *sig;
+    int i, nargs, nwords;
+    ty_t ty;
+
+    /* count arguments first so that we can size the tables */
+    nargs = 0;
+    if (text[0] == '(' && text[1] != ')') {
+        for (nargs = 1, s = text + 1; *s && *s != ')'; s++) {
+	    if (*s == ',') nargs++;
+	}
     }
-    return makeCPointer(env, (void *)result.j);
+
+    sig = (callsig_t *)calloc(1, sizeof(callsig_t));
+    if (sig == NULL ||
+	(sig->text = (char *)malloc(strlen(text) + 1)) == NULL ||
+	(sig->kinds = (char *)malloc(nargs + 1)) == NULL ||
+	(sig->argTypes = (char *)malloc(nargs * 2 + 1)) == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	goto error;
+    }
+    strcpy(sig->text, text);
+
+    s = text;
+    if (*s++ != '(') goto malformed;
+    for (nwords = 0, i = 0; i < nargs; i++) {
+        if (i > 0 && *s++ != ',') goto malformed;
+	if (!sig_code(*s++, &ty)) goto malformed;
+	sig->kinds[i] = ty;
+	sig->argTypes[nwords] = ty;
+	if (ty == TY_DOUBLE) {
+	    sig->argTypes[nwords + 1] = TY_DOUBLE2;
+	    nwords += sizeof(jdouble) / sizeof(word_t);
+	    sig->nfloats++;
+	} else if (ty == TY_LONG) {
+	    sig->argTypes[nwords + 1] = TY_LONG2;
+	    nwords += sizeof(jlong) / sizeof(word_t);
+	    sig->nints++;
+	} else {
+	    nwords++;
+	    if (ty == TY_FLOAT) {
+	        sig->nfloats++;
+	    } else {
+	        sig->nints++;
+	    }
+	}
+    }
+    if (*s++ != ')') goto malformed;
+    if (*s == 'V') {
+        sig->res_ty = TY_INTEGER;
+	sig->is_void = JNI_TRUE;
+    } else if (!sig_code(*s, &sig->res_ty)) {
+        goto malformed;
+    }
+    if (*++s != '\0') goto malformed;
+
+    sig->nargs = nargs;
+    sig->nwords = nwords;
+    return sig;
+
+malformed:
+    JNU_ThrowByName(env, "java/lang/IllegalArgumentException", text);
+error:
+    if (sig != NULL) {
+        free(sig->text);
+	free(sig->kinds);
+	free(sig->argTypes);
+	free(sig);
+    }
+    return NULL;
 }
 
-/*
- * Class:     CFunction
- * Method:    callDouble
- * Signature: ([Ljava/lang/Object;)D
+/* Fetch the signature bound to self, checking that it returns res_ty.
+ * Returns NULL, with an exception pending, on failure.
  */
-JNIEXPORT jdouble JNICALL 
-Java_CFunction_callDouble(JNIEnv *env, jobject self, jobjectArray arr)
+static callsig_t *
+sig_get(JNIEnv *env, jobject self, ty_t res_ty, jboolean is_void)
 {
-    jvalue result;
-    dispatch(env, self, arr, TY_DOUBLE, &result);
-    return result.d;
+    callsig_t *sig = (callsig_t *)env->GetLongField(self, FID_CFunction_sig);
+    if (sig == NULL) {
+        JNU_ThrowByName(env, "java/lang/IllegalStateException",
+			"no signature bound");
+	return NULL;
+    }
+    if (sig->res_ty != res_ty || sig->is_void != is_void) {
+        JNU_ThrowByName(env, "java/lang/IllegalStateException",
+			sig->text);
+	return NULL;
+    }
+    return sig;
 }
 
-/*
- * Class:     CFunction
- * Method:    callFloat
- * Signature: ([Ljava/lang/Object;)F
+/* Move the arguments into the word array following the plan in sig.
+ * The j-th integer argument is iargs[j * stride] and the j-th floating
+ * point argument fargs[j * stride]; pointer arguments are offsets from
+ * base.
  */
-JNIEXPORT jfloat JNICALL
-Java_CFunction_callFloat(JNIEnv *env, jobject self, jobjectArray arr)
+static void
+sig_marshal(callsig_t *sig,
+	    jlong *iargs,
+	    jdouble *fargs,
+	    int stride,
+	    jbyte *base,
+	    word_t *c_args)
 {
-    jvalue result;
-    dispatch(env, self, arr, TY_FLOAT, &result);
-    return result.f;
+    int i, w;
+
+    for (w = i = 0; i < sig->nargs; i++) {
+        switch (sig->kinds[i]) {
+	case TY_INTEGER:
+	    c_args[w++].i = (jint)*iargs;
+	    iargs += stride;
+	    break;
+	case TY_CPTR:
+	    c_args[w++].p = base + *iargs;
+	    iargs += stride;
+	    break;
+	case TY_LONG:
+	    *(jlong *)(c_args + w) = *iargs;
+	    w += sizeof(jlong) / sizeof(word_t);
+	    iargs += stride;
+	    break;
+	case TY_FLOAT:
+	    c_args[w++].f = (jfloat)*fargs;
+	    fargs += stride;
+	    break;
+	case TY_DOUBLE:
+	    *(jdouble *)(c_args + w) = *fargs;
+	    w += sizeof(jdouble) / sizeof(word_t);
+	    fargs += stride;
+	    break;
+	}
+    }
 }
 
-#ifdef JNI_BOOK
-
-extern "C" int asm_dispatch_int(void *func,
-                     int nwords,
-                     word_t *args,
-                     int conv);     
-
-JNIEXPORT jint JNICALL Java_CFunction_callInt
-  (JNIEnv *env, jobject self, jobjectArray arr)
+/* invoke the real native function through a precompiled signature */
+static void
+dispatch_sig(JNIEnv *env,
+	     jobject self,
+	     jlongArray iarr,
+	     jdoubleArray farr,
+	     ty_t res_ty,
+	     jboolean is_void,
+	     jvalue *resP)
 {
-#define MAX_NARGS 32
-    jint ires;
-    int nargs, nwords;
+    callsig_t *sig;
     void *func;
-    jboolean is_string[MAX_NARGS];
-    word_t args[MAX_NARGS];
+    jlong iargs_buf[INLINE_NARGS];
+    jdouble fargs_buf[INLINE_NARGS];
+    word_t c_args_buf[INLINE_NARGS * 2];
+    jlong *iargs = iargs_buf;
+    jdouble *fargs = fargs_buf;
+    word_t *c_args = c_args_buf;
     int conv;
+    scratch_mark_t mark = scratch;
 
-    nargs = env->GetArrayLength(arr);
-    if (nargs > MAX_NARGS) {
-        JNU_ThrowByName(env, 
-                    "java/lang/IllegalArgumentException",
-                    "too many arguments");
-        return 0;
+    if ((sig = sig_get(env, self, res_ty, is_void)) == NULL) {
+        return;
+    }
+    if ((sig->nints > 0 && iarr == NULL) ||
+	(sig->nfloats > 0 && farr == NULL)) {
+        JNU_ThrowByName(env, "java/lang/NullPointerException", 0);
+	return;
+    }
+    if (sig->nargs > INLINE_NARGS) {
+        iargs = (jlong *)scratch_alloc(sig->nints * sizeof(jlong));
+	fargs = (jdouble *)scratch_alloc(sig->nfloats * sizeof(jdouble));
+	c_args = (word_t *)scratch_alloc(sig->nwords * sizeof(word_t));
+	if (iargs == NULL || fargs == NULL || c_args == NULL) {
+	    JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	    goto cleanup;
+	}
     }
 
-    // convert arguments
-    for (nwords = 0; nwords < nargs; nwords++) {
-        is_string[nwords] = JNI_FALSE;
-        jobject arg = env->GetObjectArrayElement(arr, nwords);
-
-        if (arg == NULL) {
-            args[nwords].p = NULL;
-        } else if (env->IsInstanceOf(arg, Class_Integer)) {
-            args[nwords].i =
-                env->GetIntField(arg, FID_Integer_value);
-        } else if (env->IsInstanceOf(arg, Class_Float)) {
-            args[nwords].f =
-                env->GetFloatField(arg, FID_Float_value);
-        } else if (env->IsInstanceOf(arg, Class_CPointer)) {
-            args[nwords].p = (void *)
-                env->GetLongField(arg, FID_CPointer_peer);
-        } else if (env->IsInstanceOf(arg, Class_String)) {
-            char * cstr = JNU_GetStringNativeChars(env, (jstring)arg);
-            if ((args[nwords].p = cstr) == NULL) {
-                goto cleanup; // error thrown
-            }
-            is_string[nwords] = JNI_TRUE;
-        } else {
-            JNU_ThrowByName(env,
-                "java/lang/IllegalArgumentException",
-                "unrecognized argument type");
-            goto cleanup;
-        }
-        env->DeleteLocalRef(arg);
+    /* Region copies do the bounds checking for us */
+    if (sig->nints > 0) {
+        env->GetLongArrayRegion(iarr, 0, sig->nints, iargs);
+    }
+    if (sig->nfloats > 0) {
+        env->GetDoubleArrayRegion(farr, 0, sig->nfloats, fargs);
     }
+    if (env->ExceptionCheck()) {
+        goto cleanup;
+    }
+    sig_marshal(sig, iargs, fargs, 1, NULL, c_args);
 
     func = (void *)env->GetLongField(self, FID_CPointer_peer);
+#ifdef DISPATCH_THUNKS
+    if (sig->thunk != NULL) {
+        ((thunk_t)sig->thunk)(func, c_args, (word_t *)resP);
+	goto cleanup;
+    }
+#endif
     conv = env->GetIntField(self, FID_CFunction_conv);
-
-    // now transfer control to func.
-    ires = asm_dispatch_int(func, nwords, args, conv);
+    asm_dispatch(func, sig->nwords, sig->argTypes, c_args, res_ty,
+		 (word_t *)resP, conv);
 
 cleanup:
-    // free all the native strings we have created
-    for (int i = 0; i < nwords; i++) {
-        if (is_string[i]) {
-            free(args[i].p);
-        }
-    }
-    return ires;
+    scratch = mark;
 }
 
-#else /* JNI_BOOK */
-
-JNIEXPORT jint JNICALL
-Java_CFunction_callInt(JNIEnv *env, jobject self, jobjectArray arr)
+/*
+ * Invoke the real native function once per row of columnar arguments,
+ * storing each result into the results array.  All arrays are fetched
+ * once, so the JNI transition is paid per batch rather than per call.
+ */
+static void
+dispatch_batch(JNIEnv *env,
+	       jobject self,
+	       jobject base,
+	       jint count,
+	       jlongArray iarr,
+	       jdoubleArray farr,
+	       jarray resarr,
+	       ty_t res_ty)
 {
+    callsig_t *sig;
+    void *func;
+    jbyte *basep;
+    jlong *iargs = NULL;
+    jdouble *fargs = NULL;
+    jbyte *results = NULL;
+    word_t c_args_buf[INLINE_NARGS * 2];
+    word_t *c_args = c_args_buf;
     jvalue result;
-    dispatch(env, self, arr, TY_INTEGER, &result);
-    return result.i;
+    int conv, i;
+    scratch_mark_t mark = scratch;
+
+    if ((sig = sig_get(env, self, res_ty, JNI_FALSE)) == NULL) {
+        return;
+    }
+    if ((sig->nints > 0 && iarr == NULL) ||
+	(sig->nfloats > 0 && farr == NULL) || resarr == NULL) {
+        JNU_ThrowByName(env, "java/lang/NullPointerException", 0);
+	return;
+    }
+    if (count < 0 ||
+	(sig->nints > 0 &&
+	 env->GetArrayLength(iarr) < (jlong)sig->nints * count) ||
+	(sig->nfloats > 0 &&
+	 env->GetArrayLength(farr) < (jlong)sig->nfloats * count) ||
+	env->GetArrayLength(resarr) < count) {
+        if (!env->ExceptionCheck()) {
+	    JNU_ThrowByName(env, "java/lang/IndexOutOfBoundsException", 0);
+	}
+	return;
+    }
+    if (count == 0) {
+        return;
+    }
+    if (sig->nargs > INLINE_NARGS &&
+	(c_args = (word_t *)scratch_alloc(sig->nwords * sizeof(word_t)))
+	    == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	goto cleanup;
+    }
+
+    basep = base == NULL ? NULL :
+        (jbyte *)env->GetLongField(base, FID_CPointer_peer);
+    func = (void *)env->GetLongField(self, FID_CPointer_peer);
+    conv = env->GetIntField(self, FID_CFunction_conv);
+
+    if (sig->nints > 0 &&
+	(iargs = env->GetLongArrayElements(iarr, 0)) == NULL) {
+        goto cleanup;
+    }
+    if (sig->nfloats > 0 &&
+	(fargs = env->GetDoubleArrayElements(farr, 0)) == NULL) {
+        goto cleanup;
+    }
+    if (res_ty == TY_DOUBLE) {
+        results = (jbyte *)
+	    env->GetDoubleArrayElements((jdoubleArray)resarr, 0);
+    } else {
+        results = (jbyte *)env->GetIntArrayElements((jintArray)resarr, 0);
+    }
+    if (results == NULL) {
+        goto cleanup;
+    }
+
+    for (i = 0; i < count; i++) {
+        sig_marshal(sig, iargs ? iargs + i : NULL, fargs ? fargs + i : NULL,
+		    count, basep, c_args);
+#ifdef DISPATCH_THUNKS
+	if (sig->thunk != NULL) {
+	    ((thunk_t)sig->thunk)(func, c_args, (word_t *)&result);
+	} else
+#endif
+	asm_dispatch(func, sig->nwords, sig->argTypes, c_args, res_ty,
+		     (word_t *)&result, conv);
+	if (res_ty == TY_DOUBLE) {
+	    ((jdouble *)results)[i] = result.d;
+	} else {
+	    ((jint *)results)[i] = result.i;
+	}
+    }
+
+cleanup:
+    if (results != NULL) {
+        if (res_ty == TY_DOUBLE) {
+	    env->ReleaseDoubleArrayElements((jdoubleArray)resarr,
+					    (jdouble *)results, 0);
+	} else {
+	    env->ReleaseIntArrayElements((jintArray)resarr,
+					 (jint *)results, 0);
+	}
+    }
+    if (fargs != NULL) {
+        env->ReleaseDoubleArrayElements(farr, fargs, JNI_ABORT);
+    }
+    if (iargs != NULL) {
+        env->ReleaseLongArrayElements(iarr, iargs, JNI_ABORT);
+    }
+    scratch = mark;
 }
-#endif /* JNI_BOOK */
 
 /*
  * Class:     CFunction
- * Method:    callVoid
- * Signature: ([Ljava/lang/Object;)V
+ * Method:    initIDs
+ * Signature: ()V
  */
 JNIEXPORT void JNICALL
-Java_CFunction_callVoid(JNIEnv *env, jobject self, jobjectArray arr)
+Java_CFunction_initIDs(JNIEnv *env, jclass cls)
 {
-    jvalue result;
-    dispatch(env, self, arr, TY_INTEGER, &result);
+    FID_CFunction_conv = env->GetFieldID(cls, "conv", "I");
+    if (FID_CFunction_conv == NULL) return;
+    FID_CFunction_sig = env->GetFieldID(cls, "sig", "J");
+    if (FID_CFunction_sig == NULL) return;
+    FID_CFunction_critical = env->GetFieldID(cls, "critical", "Z");
+    if (FID_CFunction_critical == NULL) return;
+    Class_CFunction = (jclass)env->NewGlobalRef(cls);
 }
 
 /*
  * Class:     CFunction
- * Method:    find
- * Signature: (Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)J
+ * Method:    compileSignature
+ * Signature: (Ljava/lang/String;)J
  */
-JNIEXPORT jlong JNICALL Java_CFunction_find
-  (JNIEnv *env, jobject self, jstring lib, jstring fun)
+JNIEXPORT jlong JNICALL
+Java_CFunction_compileSignature(JNIEnv *env, jclass cls, jstring text)
 {
-    void *handle;
+    const char *str;
+    callsig_t *sig;
+
+    str = env->GetStringUTFChars(text, 0);
+    if (str == NULL) {
+        return 0; /* OutOfMemoryError already thrown */
+    }
+
+    /* Binding is rare, so a monitor on the class is good enough to
+       keep the interned list consistent. */
+    if (env->MonitorEnter(Class_CFunction) != 0) {
+        env->ReleaseStringUTFChars(text, str);
+	return 0;
+    }
+    for (sig = sigs; sig != NULL; sig = sig->next) {
+        if (strcmp(sig->text, str) == 0) {
+	    break;
+	}
+    }
+    if (sig == NULL && (sig = sig_parse(env, str)) != NULL) {
+#ifdef DISPATCH_THUNKS
+        /* NULL if out of executable memory; asm_dispatch still works */
+        sig->thunk = asm_make_thunk(sig->nwords, sig->argTypes,
+				    sig->res_ty);
+#endif
+        sig->next = sigs;
+	sigs = sig;
+    }
+    env->MonitorExit(Class_CFunction);
+
+    env->ReleaseStringUTFChars(text, str);
+    return (jlong)sig;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callInt
+ * Signature: ([J[D)I
+ */
+JNIEXPORT jint JNICALL
+Java_CFunction_callInt___3J_3D(JNIEnv *env, jobject self,
+			       jlongArray iarr, jdoubleArray farr)
+{
+    jvalue result;
+    dispatch_sig(env, self, iarr, farr, TY_INTEGER, JNI_FALSE, &result);
+    return result.i;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callVoid
+ * Signature: ([J[D)V
+ */
+JNIEXPORT void JNICALL
+Java_CFunction_callVoid___3J_3D(JNIEnv *env, jobject self,
+				jlongArray iarr, jdoubleArray farr)
+{
+    jvalue result;
+    dispatch_sig(env, self, iarr, farr, TY_INTEGER, JNI_TRUE, &result);
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callFloat
+ * Signature: ([J[D)F
+ */
+JNIEXPORT jfloat JNICALL
+Java_CFunction_callFloat___3J_3D(JNIEnv *env, jobject self,
+				 jlongArray iarr, jdoubleArray farr)
+{
+    jvalue result;
+    dispatch_sig(env, self, iarr, farr, TY_FLOAT, JNI_FALSE, &result);
+    return result.f;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callDouble
+ * Signature: ([J[D)D
+ */
+JNIEXPORT jdouble JNICALL
+Java_CFunction_callDouble___3J_3D(JNIEnv *env, jobject self,
+				  jlongArray iarr, jdoubleArray farr)
+{
+    jvalue result;
+    dispatch_sig(env, self, iarr, farr, TY_DOUBLE, JNI_FALSE, &result);
+    return result.d;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callLong
+ * Signature: ([J[D)J
+ */
+JNIEXPORT jlong JNICALL
+Java_CFunction_callLong___3J_3D(JNIEnv *env, jobject self,
+				jlongArray iarr, jdoubleArray farr)
+{
+    jvalue result;
+    dispatch_sig(env, self, iarr, farr, TY_LONG, JNI_FALSE, &result);
+    return result.j;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callCPointer
+ * Signature: ([J[D)LCPointer;
+ */
+JNIEXPORT jobject JNICALL
+Java_CFunction_callCPointer___3J_3D(JNIEnv *env, jobject self,
+				    jlongArray iarr, jdoubleArray farr)
+{
+    jvalue result;
+    dispatch_sig(env, self, iarr, farr, TY_CPTR, JNI_FALSE, &result);
+    if (env->ExceptionOccurred()) {
+        return NULL;
+    }
+    return makeCPointer(env, (void *)result.j);
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callIntBatch
+ * Signature: (LCPointer;I[J[D[I)V
+ */
+JNIEXPORT void JNICALL
+Java_CFunction_callIntBatch(JNIEnv *env, jobject self, jobject base,
+			    jint count, jlongArray iarr, jdoubleArray farr,
+			    jintArray results)
+{
+    dispatch_batch(env, self, base, count, iarr, farr, results, TY_INTEGER);
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callDoubleBatch
+ * Signature: (LCPointer;I[J[D[D)V
+ */
+JNIEXPORT void JNICALL
+Java_CFunction_callDoubleBatch(JNIEnv *env, jobject self, jobject base,
+			       jint count, jlongArray iarr, jdoubleArray farr,
+			       jdoubleArray results)
+{
+    dispatch_batch(env, self, base, count, iarr, farr, results, TY_DOUBLE);
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callCPointer
+ * Signature: ([Ljava/lang/Object;)LCPointer;
+ */
+JNIEXPORT jobject JNICALL 
+Java_CFunction_callCPointer___3Ljava_lang_Object_2(JNIEnv *env, jobject self,
+						jobjectArray arr)
+{
+    jvalue result;
+    dispatch(env, self, arr, TY_CPTR, &result);
+    if (env->ExceptionOccurred()) {
+        return NULL;
+    }
+    return makeCPointer(env, (void *)result.j);
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callLong
+ * Signature: ([Ljava/lang/Object;)J
+ */
+JNIEXPORT jlong JNICALL
+Java_CFunction_callLong___3Ljava_lang_Object_2(JNIEnv *env, jobject self,
+					       jobjectArray arr)
+{
+    jvalue result;
+    dispatch(env, self, arr, TY_LONG, &result);
+    return result.j;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callDouble
+ * Signature: ([Ljava/lang/Object;)D
+ */
+JNIEXPORT jdouble JNICALL 
+Java_CFunction_callDouble___3Ljava_lang_Object_2(JNIEnv *env, jobject self,
+						jobjectArray arr)
+{
+    jvalue result;
+    dispatch(env, self, arr, TY_DOUBLE, &result);
+    return result.d;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    callFloat
+ * Signature: ([Ljava/lang/Object;)F
+ */
+JNIEXPORT jfloat JNICALL
+Java_CFunction_callFloat___3Ljava_lang_Object_2(JNIEnv *env, jobject self,
+						jobjectArray arr)
+{
+    jvalue result;
+    dispatch(env, self, arr, TY_FLOAT, &result);
+    return result.f;
+}
+
+#ifdef JNI_BOOK
+
+extern "C" int asm_dispatch_int(void *func,
+                     int nwords,
+                     word_t *args,
+                     int conv);     
+
+JNIEXPORT jint JNICALL Java_CFunction_callInt___3Ljava_lang_Object_2
+  (JNIEnv *env, jobject self, jobjectArray arr)
+{
+#define MAX_NARGS 32
+    jint ires;
+    int nargs, nwords;
     void *func;
-    char *libname;
-    char *funname;
+    jboolean is_string[MAX_NARGS];
+    word_t args[MAX_NARGS];
+    int conv;
+
+    nargs = env->GetArrayLength(arr);
+    if (nargs > MAX_NARGS) {
+        JNU_ThrowByName(env, 
+                    "java/lang/IllegalArgumentException",
+                    "too many arguments");
+        return 0;
+    }
+
+    // convert arguments
+    for (nwords = 0; nwords < nargs; nwords++) {
+        is_string[nwords] = JNI_FALSE;
+        jobject arg = env->GetObjectArrayElement(arr, nwords);
 
-    if ((libname = JNU_GetStringNativeChars(env, lib))) {
-        if ((funname = JNU_GetStringNativeChars(env, fun))) {
-            if ((handle = (void *)LOAD_LIBRARY(libname))) {
-                if (!(func = (void *)FIND_ENTRY(handle, funname))) {
-                    JNU_ThrowByName(env, 
-                        "java/lang/UnsatisfiedLinkError",
-                        funname);
-                }
-            } else {
-                JNU_ThrowByName(env, 
-                        "java/lang/UnsatisfiedLinkError",
-                        libname);
+        if (arg == NULL) {
+            args[nwords].p = NULL;
+        } else if (env->IsInstanceOf(arg, Class_Integer)) {
+            args[nwords].i =
+                env->GetIntField(arg, FID_Integer_value);
+        } else if (env->IsInstanceOf(arg, Class_Float)) {
+            args[nwords].f =
+                env->GetFloatField(arg, FID_Float_value);
+        } else if (env->IsInstanceOf(arg, Class_CPointer)) {
+            args[nwords].p = (void *)
+                env->GetLongField(arg, FID_CPointer_peer);
+        } else if (env->IsInstanceOf(arg, Class_String)) {
+            char * cstr = JNU_GetStringNativeChars(env, (jstring)arg);
+            if ((args[nwords].p = cstr) == NULL) {
+                goto cleanup; // error thrown
             }
-            free(funname);
+            is_string[nwords] = JNI_TRUE;
+        } else {
+            JNU_ThrowByName(env,
+                "java/lang/IllegalArgumentException",
+                "unrecognized argument type");
+            goto cleanup;
         }
-        free(libname);
+        env->DeleteLocalRef(arg);
     }
-    return (jlong)func;
+
+    func = (void *)env->GetLongField(self, FID_CPointer_peer);
+    conv = env->GetIntField(self, FID_CFunction_conv);
+
+    // now transfer control to func.
+    ires = asm_dispatch_int(func, nwords, args, conv);
+
+cleanup:
+    // free all the native strings we have created
+    for (int i = 0; i < nwords; i++) {
+        if (is_string[i]) {
+            free(args[i].p);
+        }
+    }
+    return ires;
+}
+
+#else /* JNI_BOOK */
+
+JNIEXPORT jint JNICALL
+Java_CFunction_callInt___3Ljava_lang_Object_2(JNIEnv *env, jobject self,
+					      jobjectArray arr)
+{
+    jvalue result;
+    dispatch(env, self, arr, TY_INTEGER, &result);
+    return result.i;
+}
+#endif /* JNI_BOOK */
+
+/*
+ * Class:     CFunction
+ * Method:    callVoid
+ * Signature: ([Ljava/lang/Object;)V
+ */
+JNIEXPORT void JNICALL
+Java_CFunction_callVoid___3Ljava_lang_Object_2(JNIEnv *env, jobject self,
+						jobjectArray arr)
+{
+    jvalue result;
+    dispatch(env, self, arr, TY_INTEGER, &result);
+}
+
+/*
+ * Class:     CFunction
+ * Method:    invokeStruct
+ * Signature: (JIJ[Ljava/lang/Object;)V
+ */
+JNIEXPORT void JNICALL
+Java_CFunction_invokeStruct(JNIEnv *env, jobject self, jlong plan,
+			    jint size, jlong dest, jobjectArray arr)
+{
+#ifdef SOLARIS2
+    JNU_ThrowByName(env, "java/lang/UnsupportedOperationException",
+		    "structs by value");
+#else
+    clayout_t *l = (clayout_t *)plan;
+    sret_t sret;
+
+    sret.dest = (void *)dest;
+    sret.size = size;
+    sret.nwords = (size + sizeof(word_t) - 1) / sizeof(word_t);
+    if (sret.nwords <= 2) {
+        struct_words(l, sret.types, sret.nwords);
+    }
+    dispatch(env, self, arr, TY_STRUCT, (jvalue *)&sret);
+#endif
+}
+
+/*
+ * Class:     CFunction
+ * Method:    getScratchHighWater
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL
+Java_CFunction_getScratchHighWater(JNIEnv *env, jclass cls)
+{
+    return (jlong)scratch_high_water;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    getSymbolCacheHits
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL
+Java_CFunction_getSymbolCacheHits(JNIEnv *env, jclass cls)
+{
+    return sym_hits;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    getSymbolCacheMisses
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL
+Java_CFunction_getSymbolCacheMisses(JNIEnv *env, jclass cls)
+{
+    return sym_misses;
+}
+
+/* FNV-1a over both halves of a key */
+static unsigned int
+sym_hash(const char *lib, const char *fun)
+{
+    unsigned int h = 2166136261u;
+
+    for (; *lib; lib++) {
+        h = (h ^ (unsigned char)*lib) * 16777619u;
+    }
+    h *= 16777619u;		/* the separating NUL */
+    for (; *fun; fun++) {
+        h = (h ^ (unsigned char)*fun) * 16777619u;
+    }
+    return h % SYM_BUCKETS;
+}
+
+static symbol_t *
+sym_lookup(unsigned int h, const char *lib, const char *fun)
+{
+    symbol_t *sym;
+
+    for (sym = symbols[h]; sym != NULL; sym = sym->next) {
+        if (strcmp(sym->key, lib) == 0 &&
+	    strcmp(sym->key + sym->liblen + 1, fun) == 0) {
+	    return sym;
+	}
+    }
+    return NULL;
+}
+
+/* Returns the library, loading it if need be; call with the monitor
+ * held.
+ */
+static library_t *
+lib_get(const char *name)
+{
+    library_t *lib;
+    void *handle;
+
+    for (lib = libraries; lib != NULL; lib = lib->next) {
+        if (strcmp(lib->name, name) == 0) {
+	    return lib;
+	}
+    }
+    if ((handle = (void *)LOAD_LIBRARY(name)) == NULL) {
+        return NULL;
+    }
+    lib = (library_t *)malloc(sizeof(library_t) + strlen(name));
+    if (lib == NULL) {
+        UNLOAD_LIBRARY(handle);
+	return NULL;
+    }
+    lib->handle = handle;
+    strcpy(lib->name, name);
+    lib->next = libraries;
+    libraries = lib;
+    return lib;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    find
+ * Signature: (Ljava/lang/String;Ljava/lang/String;)J
+ */
+JNIEXPORT jlong JNICALL Java_CFunction_find
+  (JNIEnv *env, jobject self, jstring lib, jstring fun)
+{
+    void *func = NULL;
+    char *libname;
+    char *funname;
+    const char *missing = NULL;
+    library_t *l;
+    symbol_t *sym;
+    size_t liblen, funlen;
+    unsigned int h;
+    scratch_mark_t mark = scratch;
+
+    if ((libname = getStringScratchChars(env, lib)) == NULL ||
+	(funname = getStringScratchChars(env, fun)) == NULL) {
+        goto done;
+    }
+
+    h = sym_hash(libname, funname);
+    if ((sym = sym_lookup(h, libname, funname)) != NULL) {
+        ATOMIC_INC(&sym_hits);
+	func = sym->func;
+	goto done;
+    }
+
+    if (env->MonitorEnter(Class_CFunction) != 0) {
+        goto done;
+    }
+    /* someone else may have got here first */
+    if ((sym = sym_lookup(h, libname, funname)) != NULL) {
+        ATOMIC_INC(&sym_hits);
+	func = sym->func;
+    } else {
+        ATOMIC_INC(&sym_misses);
+	if ((l = lib_get(libname)) == NULL) {
+	    missing = libname;
+	} else if ((func = (void *)FIND_ENTRY(l->handle, funname)) == NULL) {
+	    missing = funname;
+	} else {
+	    liblen = strlen(libname);
+	    funlen = strlen(funname);
+	    sym = (symbol_t *)malloc(sizeof(symbol_t) + liblen + funlen + 1);
+	    /* failing to cache is not an error */
+	    if (sym != NULL) {
+	        sym->func = func;
+		sym->liblen = liblen;
+		memcpy(sym->key, libname, liblen + 1);
+		memcpy(sym->key + liblen + 1, funname, funlen + 1);
+		sym->next = symbols[h];
+		MEMORY_BARRIER();
+		symbols[h] = sym;
+	    }
+	}
+    }
+    env->MonitorExit(Class_CFunction);
+
+    if (missing != NULL) {
+        JNU_ThrowByName(env, "java/lang/UnsatisfiedLinkError", missing);
+    }
+
+done:
+    scratch = mark;
+    return (jlong)func;
+}
+
+/*
+ * Class:     CFunction
+ * Method:    unloadLibrary
+ * Signature: (Ljava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_CFunction_unloadLibrary(JNIEnv *env, jclass cls, jstring lib)
+{
+    char *libname;
+    library_t *l, **lp;
+    symbol_t *sym, **sp;
+    int i;
+    jboolean found = JNI_FALSE;
+    scratch_mark_t mark = scratch;
+
+    if ((libname = getStringScratchChars(env, lib)) == NULL) {
+        goto done;
+    }
+    if (env->MonitorEnter(Class_CFunction) != 0) {
+        goto done;
+    }
+    for (lp = &libraries; (l = *lp) != NULL; lp = &l->next) {
+        if (strcmp(l->name, libname) == 0) {
+	    break;
+	}
+    }
+    if (l != NULL) {
+        /* Unlink, but do not free, the symbols found in the library.
+	   Their next links are left alone so that a concurrent lookup
+	   standing on one still reaches the rest of its chain. */
+        for (i = 0; i < SYM_BUCKETS; i++) {
+	    for (sp = (symbol_t **)&symbols[i]; (sym = *sp) != NULL; ) {
+	        if (strcmp(sym->key, libname) == 0) {
+		    *sp = sym->next;
+		} else {
+		    sp = &sym->next;
+		}
+	    }
+	}
+	*lp = l->next;
+	UNLOAD_LIBRARY(l->handle);
+	free(l);
+	found = JNI_TRUE;
+    }
+    env->MonitorExit(Class_CFunction);
+
+done:
+    scratch = mark;
+    return found;
+}
+
+/********************************************************************/
+/*		     Native methods of class CPointer		    */
+/********************************************************************/
+
+/* Find out how the platform encoding relates to UTF-8, so that strings
+ * can be converted without calling String.getBytes when possible.  Any
+ * failure leaves native_encoding at ENC_OTHER, which is always safe.
+ */
+static void
+initNativeEncoding(JNIEnv *env)
+{
+    static const char *props[] = { "sun.jnu.encoding", "file.encoding" };
+    jclass cls;
+    jmethodID mid;
+    jstring key, value = NULL;
+    const char *utf, *enc;
+    char name[32];
+    int i, n;
+
+    if ((cls = env->FindClass("java/lang/System")) == NULL ||
+	(mid = env->GetStaticMethodID(cls, "getProperty",
+	         "(Ljava/lang/String;)Ljava/lang/String;")) == NULL) {
+        env->ExceptionClear();
+	return;
+    }
+    for (i = 0; value == NULL && i < 2; i++) {
+        if ((key = env->NewStringUTF(props[i])) == NULL) break;
+	value = (jstring)env->CallStaticObjectMethod(cls, mid, key);
+	env->DeleteLocalRef(key);
+	if (env->ExceptionCheck()) break;
+    }
+    env->ExceptionClear();
+    env->DeleteLocalRef(cls);
+    if (value == NULL || (utf = env->GetStringUTFChars(value, 0)) == NULL) {
+        env->ExceptionClear();
+	return;
+    }
+
+    /* canonicalize: lower case, no '-' or '_' */
+    for (n = 0, enc = utf; *enc && n < (int)sizeof(name) - 1; enc++) {
+        if (*enc != '-' && *enc != '_') {
+	    name[n++] = (*enc >= 'A' && *enc <= 'Z') ? *enc + 'a' - 'A' : *enc;
+	}
+    }
+    name[n] = 0;
+    env->ReleaseStringUTFChars(value, utf);
+    env->DeleteLocalRef(value);
+
+    if (strcmp(name, "utf8") == 0) {
+        native_encoding = ENC_UTF8;
+    } else if (strcmp(name, "iso88591") == 0 ||
+	       strcmp(name, "usascii") == 0 ||
+	       strcmp(name, "ansix3.41968") == 0 ||
+	       strcmp(name, "cp1252") == 0) {
+        native_encoding = ENC_ASCII;
+    }
+}
+
+/*
+ * Class:     CPointer
+ * Method:    initIDs
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL 
+Java_CPointer_initIDs(JNIEnv *env, jclass cls)
+{
+    int k;
+
+    Class_String = env->FindClass("java/lang/String");
+    if (Class_String == NULL) return 0;
+    Class_String = (jclass)env->NewGlobalRef(Class_String);
+    if (Class_String == NULL) return 0;
+
+    Class_Integer = env->FindClass("java/lang/Integer");
+    if (Class_Integer == NULL) return 0;
+    Class_Integer = (jclass)env->NewGlobalRef(Class_Integer);
+    if (Class_Integer == NULL) return 0;
+
+    Class_Float = env->FindClass("java/lang/Float");
+    if (Class_Float == NULL) return 0;
+    Class_Float = (jclass)env->NewGlobalRef(Class_Float);
+    if (Class_Float == NULL) return 0;
+
+    Class_Double = env->FindClass("java/lang/Double");
+    if (Class_Double == NULL) return 0;
+    Class_Double = (jclass)env->NewGlobalRef(Class_Double);
+    if (Class_Double == NULL) return 0;
+
+    Class_Long = env->FindClass("java/lang/Long");
+    if (Class_Long == NULL) return 0;
+    Class_Long = (jclass)env->NewGlobalRef(Class_Long);
+    if (Class_Long == NULL) return 0;
+
+    Class_Short = env->FindClass("java/lang/Short");
+    if (Class_Short == NULL) return 0;
+    Class_Short = (jclass)env->NewGlobalRef(Class_Short);
+    if (Class_Short == NULL) return 0;
+
+    Class_Byte = env->FindClass("java/lang/Byte");
+    if (Class_Byte == NULL) return 0;
+    Class_Byte = (jclass)env->NewGlobalRef(Class_Byte);
+    if (Class_Byte == NULL) return 0;
+
+    Class_Character = env->FindClass("java/lang/Character");
+    if (Class_Character == NULL) return 0;
+    Class_Character = (jclass)env->NewGlobalRef(Class_Character);
+    if (Class_Character == NULL) return 0;
+
+    Class_Boolean = env->FindClass("java/lang/Boolean");
+    if (Class_Boolean == NULL) return 0;
+    Class_Boolean = (jclass)env->NewGlobalRef(Class_Boolean);
+    if (Class_Boolean == NULL) return 0;
+
+    for (k = 0; k < 8; k++) {
+        Class_Arrays[k] = env->FindClass(array_sigs[k]);
+	if (Class_Arrays[k] == NULL) return 0;
+	Class_Arrays[k] = (jclass)env->NewGlobalRef(Class_Arrays[k]);
+	if (Class_Arrays[k] == NULL) return 0;
+    }
+
+    Class_CPointer = (jclass)env->NewGlobalRef(cls);
+    if (Class_CPointer == NULL) return 0;
+
+    MID_String_getBytes = 
+        env->GetMethodID(Class_String, "getBytes", "()[B");
+    if (MID_String_getBytes == NULL) return 0;
+    MID_String_init = env->GetMethodID(Class_String, "<init>", "([B)V");
+    if (MID_String_init == NULL) return 0;
+
+    FID_Integer_value = env->GetFieldID(Class_Integer, "value", "I");
+    if (FID_Integer_value == NULL) return 0;
+
+    FID_Float_value = env->GetFieldID(Class_Float, "value", "F");
+    if (FID_Float_value == NULL) return 0;
+
+    FID_Double_value = env->GetFieldID(Class_Double, "value", "D");
+    if (FID_Double_value == NULL) return 0;
+
+    FID_Long_value = env->GetFieldID(Class_Long, "value", "J");
+    if (FID_Long_value == NULL) return 0;
+
+    FID_Short_value = env->GetFieldID(Class_Short, "value", "S");
+    if (FID_Short_value == NULL) return 0;
+
+    FID_Byte_value = env->GetFieldID(Class_Byte, "value", "B");
+    if (FID_Byte_value == NULL) return 0;
+
+    FID_Character_value = env->GetFieldID(Class_Character, "value", "C");
+    if (FID_Character_value == NULL) return 0;
+
+    FID_Boolean_value = env->GetFieldID(Class_Boolean, "value", "Z");
+    if (FID_Boolean_value == NULL) return 0;
+
+    FID_CPointer_peer = env->GetFieldID(Class_CPointer, "peer", "J");
+    if (FID_CPointer_peer == NULL) return 0;
+
+    initNativeEncoding(env);
+    return sizeof(void *);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyIn
+ * Signature: (I[BII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3BII
+  (JNIEnv *env, jobject self, jint boff, jbyteArray arr, jint off, jint n)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    env->GetByteArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyIn
+ * Signature: (I[CII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3CII
+  (JNIEnv *env, jobject self, jint boff, jcharArray arr, jint off, jint n)
+{
+    jchar *peer = (jchar *)env->GetLongField(self, FID_CPointer_peer);
+    env->GetCharArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyIn
+ * Signature: (I[DII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3DII
+  (JNIEnv *env, jobject self, jint boff, jdoubleArray arr, jint off, jint n)
+{
+    jdouble *peer = (jdouble *)
+        env->GetLongField(self, FID_CPointer_peer);
+    env->GetDoubleArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyIn
+ * Signature: (I[FII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3FII
+  (JNIEnv *env, jobject self, jint boff, jfloatArray arr, jint off, jint n)
+{
+    jfloat *peer = (jfloat *)
+        env->GetLongField(self, FID_CPointer_peer);
+    env->GetFloatArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyIn
+ * Signature: (I[III)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3III
+  (JNIEnv *env, jobject self, jint boff, jintArray arr, jint off, jint n)
+{
+    jint *peer = (jint *)env->GetLongField(self, FID_CPointer_peer);
+    env->GetIntArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyIn
+ * Signature: (I[JII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3JII
+  (JNIEnv *env, jobject self, jint boff, jlongArray arr, jint off, jint n)
+{
+    jlong *peer = (jlong *)env->GetLongField(self, FID_CPointer_peer);
+    env->GetLongArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyIn
+ * Signature: (I[SII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3SII
+  (JNIEnv *env, jobject self, jint boff, jshortArray arr, jint off, jint n)
+{
+    jshort *peer = (jshort *)
+        env->GetLongField(self, FID_CPointer_peer);
+    env->GetShortArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyOut
+ * Signature: (I[BII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3BII
+  (JNIEnv *env, jobject self, jint boff, jbyteArray arr, jint off, jint n)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    env->SetByteArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyOut
+ * Signature: (I[CII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3CII
+  (JNIEnv *env, jobject self, jint boff, jcharArray arr, jint off, jint n)
+{
+    jchar *peer = (jchar *)env->GetLongField(self, FID_CPointer_peer);
+    env->SetCharArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyOut
+ * Signature: (I[DII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3DII
+  (JNIEnv *env, jobject self, jint boff, jdoubleArray arr, jint off, jint n)
+{
+    jdouble *peer = (jdouble *)
+        env->GetLongField(self, FID_CPointer_peer);
+    env->SetDoubleArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyOut
+ * Signature: (I[FII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3FII
+  (JNIEnv *env, jobject self, jint boff, jfloatArray arr, jint off, jint n)
+{
+    jfloat *peer = (jfloat *)
+        env->GetLongField(self, FID_CPointer_peer);
+    env->SetFloatArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyOut
+ * Signature: (I[III)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3III
+  (JNIEnv *env, jobject self, jint boff, jintArray arr, jint off, jint n)
+{
+    jint *peer = (jint *)env->GetLongField(self, FID_CPointer_peer);
+    env->SetIntArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyOut
+ * Signature: (I[JII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3JII
+  (JNIEnv *env, jobject self, jint boff, jlongArray arr, jint off, jint n)
+{
+    jlong *peer = (jlong *)env->GetLongField(self, FID_CPointer_peer);
+    env->SetLongArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    copyOut
+ * Signature: (I[SII)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3SII
+  (JNIEnv *env, jobject self, jint boff, jshortArray arr, jint off, jint n)
+{
+    jshort *peer = (jshort *)
+        env->GetLongField(self, FID_CPointer_peer);
+    env->SetShortArrayRegion(arr, off, n, peer + boff);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    getByte
+ * Signature: (I)B
+ */
+JNIEXPORT jbyte JNICALL Java_CPointer_getByte
+  (JNIEnv *env, jobject self, jint index)
+{
+    jbyte res;
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(&res, peer + index, sizeof(res));
+    return res;
+}
+
+/*
+ * Class:     CPointer
+ * Method:    getCPointer
+ * Signature: (I)LCPointer;
+ */
+JNIEXPORT jobject JNICALL Java_CPointer_getCPointer
+  (JNIEnv *env, jobject self, jint index)
+{
+    void *ptr;
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(&ptr, peer + index, sizeof(ptr));
+    return makeCPointer(env, ptr);
+}
+
+/*
+ * Class:     CPointer
+ * Method:    getDouble
+ * Signature: (I)D
+ */
+JNIEXPORT jdouble JNICALL Java_CPointer_getDouble
+  (JNIEnv *env, jobject self, jint index)
+{
+    jdouble res;
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(&res, peer + index, sizeof(res));
+    return res;
+}
+
+/*
+ * Class:     CPointer
+ * Method:    getFloat
+ * Signature: (I)F
+ */
+JNIEXPORT jfloat JNICALL Java_CPointer_getFloat
+  (JNIEnv *env, jobject self, jint index)
+{
+    jfloat res;
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(&res, peer + index, sizeof(res));
+    return res;
+}
+
+/*
+ * Class:     CPointer
+ * Method:    getInt
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_CPointer_getInt
+  (JNIEnv *env, jobject self, jint index)
+{
+    jint res;
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(&res, peer + index, sizeof(res));
+    return res;
+}
+
+/*
+ * Class:     CPointer
+ * Method:    getLong
+ * Signature: (I)J
+ */
+JNIEXPORT jlong JNICALL Java_CPointer_getLong
+  (JNIEnv *env, jobject self, jint index)
+{
+    jlong res;
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(&res, peer + index, sizeof(res));
+    return res;
 }
 
-/********************************************************************/
-/*		     Native methods of class CPointer		    */
-/********************************************************************/
-
 /*
  * Class:     CPointer
- * Method:    initIDs
- * Signature: ()I
+ * Method:    getShort
+ * Signature: (I)S
  */
-JNIEXPORT jint JNICALL 
-Java_CPointer_initIDs(JNIEnv *env, jclass cls)
+JNIEXPORT jshort JNICALL Java_CPointer_getShort
+  (JNIEnv *env, jobject self, jint index)
 {
-    Class_String = env->FindClass("java/lang/String");
-    if (Class_String == NULL) return 0;
-    Class_String = (jclass)env->NewGlobalRef(Class_String);
-    if (Class_String == NULL) return 0;
-
-    Class_Integer = env->FindClass("java/lang/Integer");
-    if (Class_Integer == NULL) return 0;
-    Class_Integer = (jclass)env->NewGlobalRef(Class_Integer);
-    if (Class_Integer == NULL) return 0;
+    jshort res;
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(&res, peer + index, sizeof(res));
+    return res;
+}
 
-    Class_Float = env->FindClass("java/lang/Float");
-    if (Class_Float == NULL) return 0;
-    Class_Float = (jclass)env->NewGlobalRef(Class_Float);
-    if (Class_Float == NULL) return 0;
+/*
+ * Class:     CPointer
+ * Method:    getString
+ * Signature: (I)Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_CPointer_getString
+  (JNIEnv *env, jobject self, jint index)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    return JNU_NewStringNative(env, (const char *)peer + index);
+}
 
-    Class_Double = env->FindClass("java/lang/Double");
-    if (Class_Double == NULL) return 0;
-    Class_Double = (jclass)env->NewGlobalRef(Class_Double);
-    if (Class_Double == NULL) return 0;
+/*
+ * Class:     CPointer
+ * Method:    setByte
+ * Signature: (IB)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_setByte
+  (JNIEnv *env, jobject self, jint index, jbyte value)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(peer + index, &value, sizeof(value));
+}
 
-    Class_CPointer = (jclass)env->NewGlobalRef(cls);
-    if (Class_CPointer == NULL) return 0;
+/*
+ * Class:     CPointer
+ * Method:    setCPointer
+ * Signature: (ILCPointer;)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_setCPointer
+  (JNIEnv *env, jobject self, jint index, jobject cptr)
+{
+    void *ptr = (void *)env->GetLongField(cptr, FID_CPointer_peer);
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(peer + index, &ptr, sizeof(ptr));
+}
 
-    MID_String_getBytes = 
-        env->GetMethodID(Class_String, "getBytes", "()[B");
-    if (MID_String_getBytes == NULL) return 0;
-    MID_String_init = env->GetMethodID(Class_String, "<init>", "([B)V");
-    if (MID_String_init == NULL) return 0;
+/*
+ * Class:     CPointer
+ * Method:    setDouble
+ * Signature: (ID)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_setDouble
+  (JNIEnv *env, jobject self, jint index, jdouble value)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(peer + index, &value, sizeof(value));
+}
 
-    FID_Integer_value = env->GetFieldID(Class_Integer, "value", "I");
-    if (FID_Integer_value == NULL) return 0;
+/*
+ * Class:     CPointer
+ * Method:    setFloat
+ * Signature: (IF)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_setFloat
+  (JNIEnv *env, jobject self, jint index, jfloat value)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(peer + index, &value, sizeof(value));
+}
 
-    FID_Float_value = env->GetFieldID(Class_Float, "value", "F");
-    if (FID_Float_value == NULL) return 0;
+/*
+ * Class:     CPointer
+ * Method:    setInt
+ * Signature: (II)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_setInt
+  (JNIEnv *env, jobject self, jint index, jint value)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(peer + index, &value, sizeof(value));
+}
 
-    FID_Double_value = env->GetFieldID(Class_Double, "value", "D");
-    if (FID_Double_value == NULL) return 0;
+/*
+ * Class:     CPointer
+ * Method:    setLong
+ * Signature: (IJ)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_setLong
+  (JNIEnv *env, jobject self, jint index, jlong value)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(peer + index, &value, sizeof(value));
+}
 
-    FID_CPointer_peer = env->GetFieldID(Class_CPointer, "peer", "J");
-    return sizeof(void *);
+/*
+ * Class:     CPointer
+ * Method:    setShort
+ * Signature: (IS)V
+ */
+JNIEXPORT void JNICALL Java_CPointer_setShort
+  (JNIEnv *env, jobject self, jint index, jshort value)
+{
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    memcpy(peer + index, &value, sizeof(value));
 }
 
 /*
  * Class:     CPointer
- * Method:    copyIn
- * Signature: (I[BII)V
+ * Method:    setString
+ * Signature: (ILjava/lang/String;)V
  */
-JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3BII
-  (JNIEnv *env, jobject self, jint boff, jbyteArray arr, jint off, jint n)
+JNIEXPORT void JNICALL Java_CPointer_setString
+  (JNIEnv *env, jobject self, jint index, jstring value)
 {
     jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    env->GetByteArrayRegion(arr, off, n, peer + boff);
+    scratch_mark_t mark = scratch;
+    char *str = getStringScratchChars(env, value);
+    if (str != NULL) {
+        strcpy((char *)peer + index, str);
+    }
+    scratch = mark;
 }
 
+
 /*
  * Class:     CPointer
- * Method:    copyIn
- * Signature: (I[CII)V
+ * Method:    newByteBuffer
+ * Signature: (II)Ljava/nio/ByteBuffer;
  */
-JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3CII
-  (JNIEnv *env, jobject self, jint boff, jcharArray arr, jint off, jint n)
+JNIEXPORT jobject JNICALL Java_CPointer_newByteBuffer
+  (JNIEnv *env, jobject self, jint offset, jint length)
 {
-    jchar *peer = (jchar *)env->GetLongField(self, FID_CPointer_peer);
-    env->GetCharArrayRegion(arr, off, n, peer + boff);
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
+    jobject buf = env->NewDirectByteBuffer(peer + offset, length);
+    if (buf == NULL && !env->ExceptionCheck()) {
+        /* the VM does not support direct buffers */
+        JNU_ThrowByName(env, "java/lang/UnsupportedOperationException",
+			"direct buffers not supported");
+    }
+    return buf;
 }
 
 /*
  * Class:     CPointer
- * Method:    copyIn
- * Signature: (I[DII)V
+ * Method:    fromByteBuffer
+ * Signature: (Ljava/nio/ByteBuffer;)LCPointer;
  */
-JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3DII
-  (JNIEnv *env, jobject self, jint boff, jdoubleArray arr, jint off, jint n)
+JNIEXPORT jobject JNICALL Java_CPointer_fromByteBuffer
+  (JNIEnv *env, jclass cls, jobject buf)
 {
-    jdouble *peer = (jdouble *)
-        env->GetLongField(self, FID_CPointer_peer);
-    env->GetDoubleArrayRegion(arr, off, n, peer + boff);
+    void *p;
+
+    if (buf == NULL) {
+        JNU_ThrowByName(env, "java/lang/NullPointerException", 0);
+	return NULL;
+    }
+    if ((p = env->GetDirectBufferAddress(buf)) == NULL) {
+        JNU_ThrowByName(env, "java/lang/IllegalArgumentException",
+			"not a direct buffer");
+	return NULL;
+    }
+    return makeCPointer(env, p);
+}
+
+/* Check a Java array region, throwing the exceptions that Get<Type>Array
+ * Region would.
+ */
+static jboolean
+checkArrayRegion(JNIEnv *env, jarray arr, jint off, jint n)
+{
+    if (arr == NULL) {
+        JNU_ThrowByName(env, "java/lang/NullPointerException", 0);
+	return JNI_FALSE;
+    }
+    if (off < 0 || n < 0 || off > env->GetArrayLength(arr) - n) {
+        JNU_ThrowByName(env, "java/lang/ArrayIndexOutOfBoundsException", 0);
+	return JNI_FALSE;
+    }
+    return JNI_TRUE;
 }
 
 /*
+ * Strided and gathered bulk accessors.  One native call walks the whole
+ * region with the Java array pinned, instead of one getXXX call per
+ * element.  Each element is moved with a fixed size memcpy, which the
+ * compiler turns into a single load and store whatever the alignment.
+ *
  * Class:     CPointer
- * Method:    copyIn
- * Signature: (I[FII)V
+ * Method:    get<Type>s, set<Type>s
+ * Signature: (II[<T>II)V
+ * Method:    gather<Type>s
+ * Signature: ([I[<T>II)V
  */
-JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3FII
-  (JNIEnv *env, jobject self, jint boff, jfloatArray arr, jint off, jint n)
+#define BULK_ACCESSORS(Type, jtype, jarrayType)				\
+JNIEXPORT void JNICALL Java_CPointer_get##Type##s			\
+  (JNIEnv *env, jobject self, jint boff, jint stride, jarrayType arr,	\
+   jint off, jint n)							\
+{									\
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);	\
+    jtype *buf;								\
+    jint i;								\
+									\
+    if (!checkArrayRegion(env, arr, off, n) || n == 0) {		\
+        return;								\
+    }									\
+    if ((buf = (jtype *)env->GetPrimitiveArrayCritical(arr, 0)) == NULL) { \
+        return;								\
+    }									\
+    peer += boff;							\
+    if (stride == sizeof(jtype)) {					\
+        memcpy(buf + off, peer, n * sizeof(jtype));			\
+    } else {								\
+        for (i = 0; i < n; i++) {					\
+	    memcpy(buf + off + i, peer + (ptrdiff_t)i * stride,		\
+		   sizeof(jtype));					\
+	}								\
+    }									\
+    env->ReleasePrimitiveArrayCritical(arr, buf, 0);			\
+}									\
+									\
+JNIEXPORT void JNICALL Java_CPointer_set##Type##s			\
+  (JNIEnv *env, jobject self, jint boff, jint stride, jarrayType arr,	\
+   jint off, jint n)							\
+{									\
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);	\
+    jtype *buf;								\
+    jint i;								\
+									\
+    if (!checkArrayRegion(env, arr, off, n) || n == 0) {		\
+        return;								\
+    }									\
+    if ((buf = (jtype *)env->GetPrimitiveArrayCritical(arr, 0)) == NULL) { \
+        return;								\
+    }									\
+    peer += boff;							\
+    if (stride == sizeof(jtype)) {					\
+        memcpy(peer, buf + off, n * sizeof(jtype));			\
+    } else {								\
+        for (i = 0; i < n; i++) {					\
+	    memcpy(peer + (ptrdiff_t)i * stride, buf + off + i,		\
+		   sizeof(jtype));					\
+	}								\
+    }									\
+    env->ReleasePrimitiveArrayCritical(arr, buf, JNI_ABORT);		\
+}									\
+									\
+JNIEXPORT void JNICALL Java_CPointer_gather##Type##s			\
+  (JNIEnv *env, jobject self, jintArray offsets, jarrayType arr,	\
+   jint off, jint n)							\
+{									\
+    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);	\
+    jint *offs;								\
+    jtype *buf;								\
+    jint i;								\
+									\
+    if (!checkArrayRegion(env, offsets, 0, n) ||			\
+	!checkArrayRegion(env, arr, off, n) || n == 0) {		\
+        return;								\
+    }									\
+    if ((offs = (jint *)env->GetPrimitiveArrayCritical(offsets, 0)) == NULL) { \
+        return;								\
+    }									\
+    if ((buf = (jtype *)env->GetPrimitiveArrayCritical(arr, 0)) == NULL) { \
+        env->ReleasePrimitiveArrayCritical(offsets, offs, JNI_ABORT);	\
+        return;								\
+    }									\
+    for (i = 0; i < n; i++) {						\
+        memcpy(buf + off + i, peer + offs[i], sizeof(jtype));		\
+    }									\
+    env->ReleasePrimitiveArrayCritical(arr, buf, 0);			\
+    env->ReleasePrimitiveArrayCritical(offsets, offs, JNI_ABORT);	\
+}
+
+BULK_ACCESSORS(Byte, jbyte, jbyteArray)
+BULK_ACCESSORS(Short, jshort, jshortArray)
+BULK_ACCESSORS(Char, jchar, jcharArray)
+BULK_ACCESSORS(Int, jint, jintArray)
+BULK_ACCESSORS(Long, jlong, jlongArray)
+BULK_ACCESSORS(Float, jfloat, jfloatArray)
+BULK_ACCESSORS(Double, jdouble, jdoubleArray)
+
+
+/********************************************************************/
+/*		     Native methods of class CMalloc		    */
+/********************************************************************/
+
+/*
+ * Registry of live allocations, kept while tracking is on so that leaks
+ * can be found by dumping it.  Each entry records the address, the size
+ * and the allocation site, which is interned so that the dump can group
+ * by it.  Every free removes the block's entry; with tracking off that
+ * is a single test of reg_tracking.  The tables are guarded by the
+ * CPointer class monitor.
+ */
+typedef struct reg_site {
+    struct reg_site *next;
+    jlong count, bytes;		/* scratch space for dumps */
+    char name[1];
+} reg_site_t;
+
+typedef struct reg_entry {
+    struct reg_entry *next;
+    void *p;
+    jlong size;
+    reg_site_t *site;
+} reg_entry_t;
+
+#define REG_BUCKETS 1024
+#define REG_HASH(p) ((unsigned int)(((size_t)(p) >> 4) % REG_BUCKETS))
+
+static volatile int reg_tracking;
+static reg_entry_t *reg_table[REG_BUCKETS];
+static reg_site_t *reg_sites;
+
+static void
+reg_remove(JNIEnv *env, void *p)
+{
+    reg_entry_t *e, **ep;
+
+    if (!reg_tracking || p == NULL) {
+        return;
+    }
+    if (env->MonitorEnter(Class_CPointer) != 0) {
+        return;
+    }
+    for (ep = &reg_table[REG_HASH(p)]; (e = *ep) != NULL; ep = &e->next) {
+        if (e->p == p) {
+	    *ep = e->next;
+	    free(e);
+	    break;
+	}
+    }
+    env->MonitorExit(Class_CPointer);
+}
+
+/* Drop every entry; call with the monitor held. */
+static void
+reg_clear(void)
+{
+    reg_entry_t *e, *next;
+    int i;
+
+    for (i = 0; i < REG_BUCKETS; i++) {
+        for (e = reg_table[i]; e != NULL; e = next) {
+	    next = e->next;
+	    free(e);
+	}
+	reg_table[i] = NULL;
+    }
+}
+
+/*
+ * Class:     CMalloc
+ * Method:    enableTracking
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL Java_CMalloc_enableTracking
+  (JNIEnv *env, jclass cls, jboolean on)
+{
+    if (env->MonitorEnter(Class_CPointer) != 0) {
+        return;
+    }
+    if (!on) {
+        /* frees from now on are not seen, so the entries would go stale */
+        reg_clear();
+    }
+    reg_tracking = on;
+    env->MonitorExit(Class_CPointer);
+}
+
+/*
+ * Class:     CMalloc
+ * Method:    track
+ * Signature: (JILjava/lang/String;)V
+ */
+JNIEXPORT void JNICALL Java_CMalloc_track
+  (JNIEnv *env, jclass cls, jlong peer, jint size, jstring site)
+{
+    const char *name;
+    reg_site_t *s;
+    reg_entry_t *e;
+    unsigned int h = REG_HASH(peer);
+
+    if ((name = env->GetStringUTFChars(site, 0)) == NULL) {
+        return;
+    }
+    if (env->MonitorEnter(Class_CPointer) != 0) {
+        env->ReleaseStringUTFChars(site, name);
+        return;
+    }
+    for (s = reg_sites; s != NULL; s = s->next) {
+        if (strcmp(s->name, name) == 0) {
+	    break;
+	}
+    }
+    if (s == NULL &&
+	(s = (reg_site_t *)malloc(sizeof(reg_site_t) + strlen(name))) != NULL) {
+        strcpy(s->name, name);
+	s->next = reg_sites;
+	reg_sites = s;
+    }
+    /* a block is only missed by the registry if we run out of memory */
+    if (reg_tracking && s != NULL &&
+	(e = (reg_entry_t *)malloc(sizeof(reg_entry_t))) != NULL) {
+        e->p = (void *)peer;
+	e->size = size;
+	e->site = s;
+	e->next = reg_table[h];
+	reg_table[h] = e;
+    }
+    env->MonitorExit(Class_CPointer);
+    env->ReleaseStringUTFChars(site, name);
+}
+
+/*
+ * Class:     CMalloc
+ * Method:    dumpAllocations
+ * Signature: ()Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_CMalloc_dumpAllocations
+  (JNIEnv *env, jclass cls)
+{
+    reg_site_t *s, *sorted = NULL, **sp;
+    reg_entry_t *e;
+    jlong count = 0, bytes = 0;
+    size_t len = 64;
+    char *text = NULL, *t;
+    jstring result = NULL;
+    int i;
+
+    if (env->MonitorEnter(Class_CPointer) != 0) {
+        return NULL;
+    }
+    for (s = reg_sites; s != NULL; s = s->next) {
+        s->count = s->bytes = 0;
+    }
+    for (i = 0; i < REG_BUCKETS; i++) {
+        for (e = reg_table[i]; e != NULL; e = e->next) {
+	    e->site->count++;
+	    e->site->bytes += e->size;
+	    count++;
+	    bytes += e->size;
+	}
+    }
+    /* Sort the sites with live blocks by bytes, largest first.  The
+       sites list is rebuilt from the sorted one and the empty ones. */
+    while ((s = reg_sites) != NULL) {
+        reg_sites = s->next;
+	for (sp = &sorted; *sp != NULL && (*sp)->bytes >= s->bytes;
+	     sp = &(*sp)->next)
+	    ;
+	s->next = *sp;
+	*sp = s;
+	len += strlen(s->name) + 48;
+    }
+    reg_sites = sorted;
+
+    if ((text = (char *)malloc(len)) != NULL) {
+        t = text + sprintf(text, "%lld bytes live in %lld blocks\n",
+			   (long long)bytes, (long long)count);
+	for (s = reg_sites; s != NULL && s->count > 0; s = s->next) {
+	    t += sprintf(t, "%12lld %8lld  %s\n", (long long)s->bytes,
+			 (long long)s->count, s->name);
+	}
+    }
+    env->MonitorExit(Class_CPointer);
+
+    if (text == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	return NULL;
+    }
+    result = JNU_NewStringNative(env, text);
+    free(text);
+    return result;
+}
+
+/*
+ * Class:     CMalloc
+ * Method:    malloc
+ * Signature: (I)J
+ */
+JNIEXPORT jlong JNICALL Java_CMalloc_malloc
+  (JNIEnv *env, jclass cls, jint size)
 {
-    jfloat *peer = (jfloat *)
-        env->GetLongField(self, FID_CPointer_peer);
-    env->GetFloatArrayRegion(arr, off, n, peer + boff);
+    return (jlong)malloc(size);
 }
 
 /*
- * Class:     CPointer
- * Method:    copyIn
- * Signature: (I[III)V
+ * Class:     CMalloc
+ * Method:    free
+ * Signature: (J)V
  */
-JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3III
-  (JNIEnv *env, jobject self, jint boff, jintArray arr, jint off, jint n)
+JNIEXPORT void JNICALL Java_CMalloc_free
+  (JNIEnv *env, jclass cls, jlong peer)
 {
-    jint *peer = (jint *)env->GetLongField(self, FID_CPointer_peer);
-    env->GetIntArrayRegion(arr, off, n, peer + boff);
+    reg_remove(env, (void *)peer);
+    free((void *)peer);
 }
 
 /*
- * Class:     CPointer
- * Method:    copyIn
- * Signature: (I[JII)V
+ * Size-classed pool for small, short-lived blocks.  Blocks of 16 to
+ * 2048 bytes, in powers of two, are carved out of 64K slabs; anything
+ * larger goes straight to malloc.  Each thread keeps a free list per
+ * class, so allocation and free are usually a pointer pop or push with
+ * no locking.  A thread's list is refilled from, and spills over to, a
+ * global list under the CPointer class monitor, a batch at a time.
+ * Slabs are never given back to the C heap, and a thread that exits
+ * strands at most POOL_CACHE_MAX blocks per class in its cache.
  */
-JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3JII
-  (JNIEnv *env, jobject self, jint boff, jlongArray arr, jint off, jint n)
+#define POOL_CLASSES	8
+#define POOL_MIN_SHIFT	4		/* smallest class is 16 bytes */
+#define POOL_SLAB	65536
+#define POOL_BATCH	32
+#define POOL_CACHE_MAX	(2 * POOL_BATCH)
+
+/* Indices into the array returned by CMalloc.getPoolStats */
+#define STAT_LIVE_BYTES	0		/* bytes requested, live, pooled */
+#define STAT_SLAB_BYTES	1		/* bytes held in slabs */
+#define STAT_LARGE_BYTES 2		/* bytes live, passed to malloc */
+#define STAT_IN_USE	3		/* + 2 * class: blocks handed out */
+#define STAT_CARVED	4		/* + 2 * class: blocks in slabs */
+#define POOL_NSTATS	(3 + 2 * POOL_CLASSES)
+
+typedef struct pool_block {
+    struct pool_block *next;
+} pool_block_t;
+
+typedef struct {
+    pool_block_t *head;
+    int count;
+} pool_cache_t;
+
+static THREAD_LOCAL pool_cache_t pool_cache[POOL_CLASSES];
+static pool_block_t *pool_free[POOL_CLASSES];	/* guarded by monitor */
+static volatile jlong pool_stats[POOL_NSTATS];
+
+/* Returns the size class for a request, or -1 if it is too big */
+static int
+pool_class(jint size)
 {
-    jlong *peer = (jlong *)env->GetLongField(self, FID_CPointer_peer);
-    env->GetLongArrayRegion(arr, off, n, peer + boff);
+    int c = 0;
+
+    while ((1 << (c + POOL_MIN_SHIFT)) < size) {
+        if (++c == POOL_CLASSES) {
+	    return -1;
+	}
+    }
+    return c;
 }
 
-/*
- * Class:     CPointer
- * Method:    copyIn
- * Signature: (I[SII)V
+/* Refill an empty thread cache from the global list, or from a new slab
+ * if that is empty too.  Returns JNI_FALSE with an exception pending on
+ * failure.
  */
-JNIEXPORT void JNICALL Java_CPointer_copyIn__I_3SII
-  (JNIEnv *env, jobject self, jint boff, jshortArray arr, jint off, jint n)
+static jboolean
+pool_refill(JNIEnv *env, int c)
 {
-    jshort *peer = (jshort *)
-        env->GetLongField(self, FID_CPointer_peer);
-    env->GetShortArrayRegion(arr, off, n, peer + boff);
+    pool_cache_t *cache = &pool_cache[c];
+    size_t bsize = (size_t)1 << (c + POOL_MIN_SHIFT);
+    pool_block_t *b;
+    char *slab;
+    int n;
+
+    if (env->MonitorEnter(Class_CPointer) != 0) {
+        return JNI_FALSE;
+    }
+    for (n = 0; n < POOL_BATCH && (b = pool_free[c]) != NULL; n++) {
+        pool_free[c] = b->next;
+	b->next = cache->head;
+	cache->head = b;
+    }
+    cache->count += n;
+    if (n == 0 && (slab = (char *)malloc(POOL_SLAB + 15)) != NULL) {
+        /* malloc may only align to 8; slabs are never freed, so the
+	   start can simply be moved up */
+        slab = (char *)(((size_t)slab + 15) & ~(size_t)15);
+        for (n = 0; n < (int)(POOL_SLAB / bsize); n++) {
+	    b = (pool_block_t *)(slab + n * bsize);
+	    b->next = cache->head;
+	    cache->head = b;
+	}
+	cache->count += n;
+	pool_stats[STAT_SLAB_BYTES] += POOL_SLAB;
+	pool_stats[STAT_CARVED + 2 * c] += n;
+    }
+    env->MonitorExit(Class_CPointer);
+
+    if (cache->head == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	return JNI_FALSE;
+    }
+    return JNI_TRUE;
 }
 
-/*
- * Class:     CPointer
- * Method:    copyOut
- * Signature: (I[BII)V
- */
-JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3BII
-  (JNIEnv *env, jobject self, jint boff, jbyteArray arr, jint off, jint n)
+/* Hand a batch of an overfull thread cache back to the global list */
+static void
+pool_spill(JNIEnv *env, int c)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    env->SetByteArrayRegion(arr, off, n, peer + boff);
+    pool_cache_t *cache = &pool_cache[c];
+    pool_block_t *b;
+    int n;
+
+    if (env->MonitorEnter(Class_CPointer) != 0) {
+        return; /* keep them; the cache is merely too big */
+    }
+    for (n = 0; n < POOL_BATCH; n++) {
+        b = cache->head;
+	cache->head = b->next;
+	b->next = pool_free[c];
+	pool_free[c] = b;
+    }
+    cache->count -= n;
+    env->MonitorExit(Class_CPointer);
 }
 
-/*
- * Class:     CPointer
- * Method:    copyOut
- * Signature: (I[CII)V
- */
-JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3CII
-  (JNIEnv *env, jobject self, jint boff, jcharArray arr, jint off, jint n)
+static void
+pool_release(JNIEnv *env, void *p, jint size)
 {
-    jchar *peer = (jchar *)env->GetLongField(self, FID_CPointer_peer);
-    env->SetCharArrayRegion(arr, off, n, peer + boff);
+    int c = pool_class(size);
+    pool_cache_t *cache;
+    pool_block_t *b = (pool_block_t *)p;
+
+    if (p == NULL) {
+        return;
+    }
+    reg_remove(env, p);
+    if (c < 0) {
+        free(p);
+	ATOMIC_ADD(&pool_stats[STAT_LARGE_BYTES], -(jlong)size);
+	return;
+    }
+    cache = &pool_cache[c];
+    b->next = cache->head;
+    cache->head = b;
+    ATOMIC_ADD(&pool_stats[STAT_LIVE_BYTES], -(jlong)size);
+    ATOMIC_ADD(&pool_stats[STAT_IN_USE + 2 * c], -1);
+    if (++cache->count > POOL_CACHE_MAX) {
+        pool_spill(env, c);
+    }
 }
 
 /*
- * Class:     CPointer
- * Method:    copyOut
- * Signature: (I[DII)V
+ * Class:     CMalloc
+ * Method:    poolAlloc
+ * Signature: (I)J
  */
-JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3DII
-  (JNIEnv *env, jobject self, jint boff, jdoubleArray arr, jint off, jint n)
+JNIEXPORT jlong JNICALL Java_CMalloc_poolAlloc
+  (JNIEnv *env, jclass cls, jint size)
 {
-    jdouble *peer = (jdouble *)
-        env->GetLongField(self, FID_CPointer_peer);
-    env->SetDoubleArrayRegion(arr, off, n, peer + boff);
+    int c = pool_class(size);
+    pool_cache_t *cache;
+    pool_block_t *b;
+
+    if (c < 0) {
+        void *p = malloc(size);
+	if (p != NULL) {
+	    ATOMIC_ADD(&pool_stats[STAT_LARGE_BYTES], size);
+	}
+	return (jlong)p;
+    }
+    cache = &pool_cache[c];
+    if (cache->head == NULL && !pool_refill(env, c)) {
+        return 0;
+    }
+    b = cache->head;
+    cache->head = b->next;
+    cache->count--;
+    ATOMIC_ADD(&pool_stats[STAT_LIVE_BYTES], size);
+    ATOMIC_INC(&pool_stats[STAT_IN_USE + 2 * c]);
+    return (jlong)b;
 }
 
 /*
- * Class:     CPointer
- * Method:    copyOut
- * Signature: (I[FII)V
+ * Class:     CMalloc
+ * Method:    poolFree
+ * Signature: (JI)V
  */
-JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3FII
-  (JNIEnv *env, jobject self, jint boff, jfloatArray arr, jint off, jint n)
+JNIEXPORT void JNICALL Java_CMalloc_poolFree
+  (JNIEnv *env, jclass cls, jlong peer, jint size)
 {
-    jfloat *peer = (jfloat *)
-        env->GetLongField(self, FID_CPointer_peer);
-    env->SetFloatArrayRegion(arr, off, n, peer + boff);
+    pool_release(env, (void *)peer, size);
 }
 
 /*
- * Class:     CPointer
- * Method:    copyOut
- * Signature: (I[III)V
+ * Class:     CMalloc
+ * Method:    freeBulk
+ * Signature: ([J[II)V
  */
-JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3III
-  (JNIEnv *env, jobject self, jint boff, jintArray arr, jint off, jint n)
+JNIEXPORT void JNICALL Java_CMalloc_freeBulk
+  (JNIEnv *env, jclass cls, jlongArray peers, jintArray sizes, jint n)
 {
-    jint *peer = (jint *)env->GetLongField(self, FID_CPointer_peer);
-    env->SetIntArrayRegion(arr, off, n, peer + boff);
+    jlong *p;
+    jint *sz;
+    jint i;
+
+    /* Not critical: freeing may need the monitor */
+    if ((p = env->GetLongArrayElements(peers, 0)) == NULL) {
+        return;
+    }
+    if ((sz = env->GetIntArrayElements(sizes, 0)) == NULL) {
+        env->ReleaseLongArrayElements(peers, p, JNI_ABORT);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        if (sz[i] < 0) {
+	    reg_remove(env, (void *)p[i]);
+	    free((void *)p[i]);
+	} else {
+	    pool_release(env, (void *)p[i], sz[i]);
+	}
+    }
+    env->ReleaseIntArrayElements(sizes, sz, JNI_ABORT);
+    env->ReleaseLongArrayElements(peers, p, JNI_ABORT);
 }
 
 /*
- * Class:     CPointer
- * Method:    copyOut
- * Signature: (I[JII)V
+ * Class:     CMalloc
+ * Method:    getPoolStats
+ * Signature: ()[J
  */
-JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3JII
-  (JNIEnv *env, jobject self, jint boff, jlongArray arr, jint off, jint n)
+JNIEXPORT jlongArray JNICALL Java_CMalloc_getPoolStats
+  (JNIEnv *env, jclass cls)
 {
-    jlong *peer = (jlong *)env->GetLongField(self, FID_CPointer_peer);
-    env->SetLongArrayRegion(arr, off, n, peer + boff);
+    jlong stats[POOL_NSTATS];
+    jlongArray arr;
+    int i;
+
+    /* counters are read one by one; a snapshot is only approximate */
+    for (i = 0; i < POOL_NSTATS; i++) {
+        stats[i] = pool_stats[i];
+    }
+    if ((arr = env->NewLongArray(POOL_NSTATS)) != NULL) {
+        env->SetLongArrayRegion(arr, 0, POOL_NSTATS, stats);
+    }
+    return arr;
 }
 
+
+/********************************************************************/
+/*		     Native methods of class CArena		    */
+/********************************************************************/
+
+/* Each chunk is preceded by a header linking it to the next and holding
+ * the address malloc returned.  malloc may only align to 8, so the
+ * chunk is placed at the first 16-byte boundary after the header.
+ */
+#define ARENA_HDR 16
+#define ARENA_NEXT(chunk) (((jbyte **)((jbyte *)(chunk) - ARENA_HDR))[0])
+#define ARENA_BASE(chunk) (((void **)((jbyte *)(chunk) - ARENA_HDR))[1])
+
 /*
- * Class:     CPointer
- * Method:    copyOut
- * Signature: (I[SII)V
+ * Class:     CArena
+ * Method:    newChunk
+ * Signature: (JI)J
  */
-JNIEXPORT void JNICALL Java_CPointer_copyOut__I_3SII
-  (JNIEnv *env, jobject self, jint boff, jshortArray arr, jint off, jint n)
+JNIEXPORT jlong JNICALL Java_CArena_newChunk
+  (JNIEnv *env, jclass cls, jlong next, jint size)
 {
-    jshort *peer = (jshort *)
-        env->GetLongField(self, FID_CPointer_peer);
-    env->SetShortArrayRegion(arr, off, n, peer + boff);
+    void *base = malloc(ARENA_HDR + 15 + size);
+    jbyte *chunk;
+
+    if (base == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	return 0;
+    }
+    chunk = (jbyte *)(((size_t)base + ARENA_HDR + 15) & ~(size_t)15);
+    ARENA_NEXT(chunk) = (jbyte *)next;
+    ARENA_BASE(chunk) = base;
+    return (jlong)chunk;
 }
 
 /*
- * Class:     CPointer
- * Method:    getByte
- * Signature: (I)B
+ * Class:     CArena
+ * Method:    freeChunks
+ * Signature: (J)V
  */
-JNIEXPORT jbyte JNICALL Java_CPointer_getByte
-  (JNIEnv *env, jobject self, jint index)
+JNIEXPORT void JNICALL Java_CArena_freeChunks
+  (JNIEnv *env, jclass cls, jlong chunks)
 {
-    jbyte res;
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(&res, peer + index, sizeof(res));
-    return res;
+    jbyte *chunk = (jbyte *)chunks;
+    jbyte *next;
+
+    for (; chunk != NULL; chunk = next) {
+        next = ARENA_NEXT(chunk);
+	free(ARENA_BASE(chunk));
+    }
 }
 
+
+/********************************************************************/
+/*		     Native methods of class CStruct		    */
+/********************************************************************/
+
 /*
- * Class:     CPointer
- * Method:    getCPointer
- * Signature: (I)LCPointer;
+ * A compiled struct layout: the offset and type of each field, and when
+ * bound to a Java class, the field ID to copy it to and from.  Layouts
+ * are interned by type string, class and field names, like call
+ * signatures, and live for the life of the process.
  */
-JNIEXPORT jobject JNICALL Java_CPointer_getCPointer
-  (JNIEnv *env, jobject self, jint index)
+typedef struct {
+    jint offset;
+    char type;			/* B S C I J F D P, as in CStruct */
+    jfieldID fid;		/* NULL if not bound */
+} cfield_t;
+
+typedef struct clayout {
+    struct clayout *next;
+    char *text;			/* the type string */
+    jclass cls;			/* bound class, or NULL */
+    char *names;		/* if bound, field names as "a\0b\0" */
+    size_t nameslen;		/* bytes in names */
+    jint nfields;
+    jint size;
+    jint align;
+    jint nints;			/* fields read into long[] */
+    jint nfloats;		/* fields read into double[] */
+    cfield_t fields[1];
+} clayout_t;
+
+static clayout_t *layouts;	/* guarded by the CStruct class monitor */
+
+/* Alignment of each C type, as the compiler lays it out */
+template <class T> struct align_probe { char c; T t; };
+#define ALIGN_OF(type) ((jint)offsetof(align_probe<type>, t))
+
+static jint
+field_size(char type, jint *align)
 {
-    void *ptr;
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(&ptr, peer + index, sizeof(ptr));
-    return makeCPointer(env, ptr);
+    switch (type) {
+    case 'B': *align = ALIGN_OF(jbyte);   return sizeof(jbyte);
+    case 'S': *align = ALIGN_OF(jshort);  return sizeof(jshort);
+    case 'C': *align = ALIGN_OF(jchar);   return sizeof(jchar);
+    case 'I': *align = ALIGN_OF(jint);    return sizeof(jint);
+    case 'J': *align = ALIGN_OF(jlong);   return sizeof(jlong);
+    case 'F': *align = ALIGN_OF(jfloat);  return sizeof(jfloat);
+    case 'D': *align = ALIGN_OF(jdouble); return sizeof(jdouble);
+    case 'P': *align = ALIGN_OF(void *);  return sizeof(void *);
+    }
+    return -1;
+}
+
+/* Java field type for each C type; pointers are held as longs */
+static const char *
+field_sig(char type)
+{
+    static const char types[] = "BSCIJFD";
+    static const char sigs[][2] = { "B", "S", "C", "I", "J", "F", "D" };
+    const char *p = strchr(types, type);
+    return p != NULL ? sigs[p - types] : "J";
 }
 
 /*
- * Class:     CPointer
- * Method:    getDouble
- * Signature: (I)D
+ * Class:     CStruct
+ * Method:    initIDs
+ * Signature: ()V
  */
-JNIEXPORT jdouble JNICALL Java_CPointer_getDouble
-  (JNIEnv *env, jobject self, jint index)
+JNIEXPORT void JNICALL
+Java_CStruct_initIDs(JNIEnv *env, jclass cls)
 {
-    jdouble res;
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(&res, peer + index, sizeof(res));
-    return res;
+    jclass value;
+
+    FID_CStruct_plan = env->GetFieldID(cls, "plan", "J");
+    if (FID_CStruct_plan == NULL) return;
+
+    value = env->FindClass("CStruct$Value");
+    if (value == NULL) return;
+    FID_CStructValue_layout = env->GetFieldID(value, "layout", "LCStruct;");
+    if (FID_CStructValue_layout == NULL) return;
+    FID_CStructValue_ptr = env->GetFieldID(value, "ptr", "LCPointer;");
+    if (FID_CStructValue_ptr == NULL) return;
+    FID_CStructValue_offset = env->GetFieldID(value, "offset", "I");
+    if (FID_CStructValue_offset == NULL) return;
+    Class_CStructValue = (jclass)env->NewGlobalRef(value);
 }
 
-/*
- * Class:     CPointer
- * Method:    getFloat
- * Signature: (I)F
+/* Find the layout and address of a CStruct.Value argument.  Returns
+ * NULL, with an exception pending, if the struct has no address.
  */
-JNIEXPORT jfloat JNICALL Java_CPointer_getFloat
-  (JNIEnv *env, jobject self, jint index)
+static clayout_t *
+struct_value(JNIEnv *env, jobject val, void **addrP, jint *sizeP)
 {
-    jfloat res;
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(&res, peer + index, sizeof(res));
-    return res;
+    jobject layout = env->GetObjectField(val, FID_CStructValue_layout);
+    jobject ptr = env->GetObjectField(val, FID_CStructValue_ptr);
+    clayout_t *l = (clayout_t *)env->GetLongField(layout, FID_CStruct_plan);
+    jlong peer = env->GetLongField(ptr, FID_CPointer_peer);
+
+    env->DeleteLocalRef(layout);
+    env->DeleteLocalRef(ptr);
+    if (peer == 0) {
+        JNU_ThrowByName(env, "java/lang/NullPointerException", 0);
+	return NULL;
+    }
+    *addrP = (char *)peer + env->GetIntField(val, FID_CStructValue_offset);
+    *sizeP = l->size;
+    return l;
 }
 
 /*
- * Class:     CPointer
- * Method:    getInt
- * Signature: (I)I
+ * Classify the words of a struct passed or returned by value, the way
+ * the x86-64 ABI classifies its eightbytes: TY_SWORD_FLT if only float
+ * and double fields overlap the word, TY_SWORD_INT otherwise.  The
+ * first word is flagged with TY_SFIRST so that the backend can tell
+ * adjacent structs apart.
  */
-JNIEXPORT jint JNICALL Java_CPointer_getInt
-  (JNIEnv *env, jobject self, jint index)
+static void
+struct_words(clayout_t *l, char *types, int nwords)
 {
-    jint res;
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(&res, peer + index, sizeof(res));
-    return res;
+    jint i, align;
+    int k;
+
+    for (k = 0; k < nwords; k++) {
+        types[k] = TY_SWORD_FLT;
+    }
+    for (i = 0; i < l->nfields; i++) {
+        cfield_t *f = &l->fields[i];
+	if (f->type != 'F' && f->type != 'D') {
+	    int first = f->offset / sizeof(word_t);
+	    int last = (f->offset + field_size(f->type, &align) - 1) /
+	               sizeof(word_t);
+	    for (k = first; k <= last; k++) {
+	        types[k] = TY_SWORD_INT;
+	    }
+	}
+    }
+    if (nwords > 0) {
+        types[0] |= TY_SFIRST;
+    }
 }
 
-/*
- * Class:     CPointer
- * Method:    getLong
- * Signature: (I)J
+/* Join the n field names into one malloc'ed block, each followed by a
+ * NUL, and store its length in *lenP.  Returns NULL, with an exception
+ * pending, on failure.
  */
-JNIEXPORT jlong JNICALL Java_CPointer_getLong
-  (JNIEnv *env, jobject self, jint index)
+static char *
+join_names(JNIEnv *env, jobjectArray names, jint n, size_t *lenP)
 {
-    jlong res;
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(&res, peer + index, sizeof(res));
-    return res;
+    size_t len = 0, cap = 64, k;
+    char *buf = (char *)malloc(cap), *nbuf;
+    jint i;
+
+    if (buf == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        jstring name = (jstring)env->GetObjectArrayElement(names, i);
+	const char *cname;
+	if (name == NULL) {
+	    if (!env->ExceptionCheck()) {
+	        JNU_ThrowByName(env, "java/lang/NullPointerException", 0);
+	    }
+	    free(buf);
+	    return NULL;
+	}
+	if ((cname = env->GetStringUTFChars(name, 0)) == NULL) {
+	    free(buf);
+	    return NULL;
+	}
+	k = strlen(cname) + 1;
+	if (len + k > cap) {
+	    cap = (len + k) * 2;
+	    if ((nbuf = (char *)realloc(buf, cap)) == NULL) {
+	        env->ReleaseStringUTFChars(name, cname);
+		free(buf);
+		JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+		return NULL;
+	    }
+	    buf = nbuf;
+	}
+	memcpy(buf + len, cname, k);
+	len += k;
+	env->ReleaseStringUTFChars(name, cname);
+	env->DeleteLocalRef(name);
+    }
+    *lenP = len;
+    return buf;
 }
 
 /*
- * Class:     CPointer
- * Method:    getShort
- * Signature: (I)S
+ * Class:     CStruct
+ * Method:    compile
+ * Signature: (Ljava/lang/String;[Ljava/lang/String;Ljava/lang/Class;[I)J
  */
-JNIEXPORT jshort JNICALL Java_CPointer_getShort
-  (JNIEnv *env, jobject self, jint index)
+JNIEXPORT jlong JNICALL Java_CStruct_compile
+  (JNIEnv *env, jclass self, jstring types, jobjectArray names,
+   jclass cls, jintArray info)
+{
+    const char *text;
+    char *cnames = NULL, *cname;
+    size_t nameslen = 0;
+    clayout_t *l;
+    jint n, i, off, sz, align, *out;
+
+    if ((text = env->GetStringUTFChars(types, 0)) == NULL) {
+        return 0;
+    }
+    n = (jint)strlen(text);
+    if (cls != NULL &&
+	(cnames = join_names(env, names, n, &nameslen)) == NULL) {
+        env->ReleaseStringUTFChars(types, text);
+	return 0;
+    }
+    if (env->MonitorEnter(self) != 0) {
+        env->ReleaseStringUTFChars(types, text);
+	free(cnames);
+        return 0;
+    }
+    for (l = layouts; l != NULL; l = l->next) {
+        if (strcmp(l->text, text) == 0 &&
+	    (cls == NULL ? l->cls == NULL :
+	     l->cls != NULL && env->IsSameObject(l->cls, cls) &&
+	     l->nameslen == nameslen &&
+	     memcmp(l->names, cnames, nameslen) == 0)) {
+	    break;
+	}
+    }
+    if (l != NULL) {
+        goto done;
+    }
+
+    l = (clayout_t *)calloc(1, sizeof(clayout_t) + n * sizeof(cfield_t) +
+			    n + 1 + nameslen);
+    if (l == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	goto done;
+    }
+    l->text = (char *)(l->fields + n + 1);
+    strcpy(l->text, text);
+    if (cls != NULL) {
+        l->names = l->text + n + 1;
+	l->nameslen = nameslen;
+	memcpy(l->names, cnames, nameslen);
+    }
+    cname = l->names;
+    l->nfields = n;
+    l->align = 1;
+    for (off = 0, i = 0; i < n; i++) {
+        cfield_t *f = &l->fields[i];
+	if ((sz = field_size(text[i], &align)) < 0) {
+	    JNU_ThrowByName(env, "java/lang/IllegalArgumentException",
+			    "bad field type");
+	    free(l);
+	    l = NULL;
+	    goto done;
+	}
+	off = (off + align - 1) & -align;
+	f->offset = off;
+	f->type = text[i];
+	off += sz;
+	if (align > l->align) {
+	    l->align = align;
+	}
+	if (text[i] == 'F' || text[i] == 'D') {
+	    l->nfloats++;
+	} else {
+	    l->nints++;
+	}
+	if (cls != NULL) {
+	    f->fid = env->GetFieldID(cls, cname, field_sig(text[i]));
+	    cname += strlen(cname) + 1;
+	    if (f->fid == NULL) {
+	        /* NoSuchFieldError pending */
+	        free(l);
+		l = NULL;
+		goto done;
+	    }
+	}
+    }
+    /* the struct is padded to a multiple of its alignment */
+    l->size = (off + l->align - 1) & -l->align;
+    if (cls != NULL && (l->cls = (jclass)env->NewGlobalRef(cls)) == NULL) {
+        free(l);
+	l = NULL;
+	goto done;
+    }
+    l->next = layouts;
+    layouts = l;
+
+done:
+    env->MonitorExit(self);
+    env->ReleaseStringUTFChars(types, text);
+    free(cnames);
+
+    /* report offsets, then size and alignment */
+    if (l != NULL &&
+	(out = env->GetIntArrayElements(info, 0)) != NULL) {
+        for (i = 0; i < l->nfields; i++) {
+	    out[i] = l->fields[i].offset;
+	}
+	out[i++] = l->size;
+	out[i] = l->align;
+	env->ReleaseIntArrayElements(info, out, 0);
+    }
+    return (jlong)l;
+}
+
+/* Copy one struct at p into the fields of obj */
+static void
+struct_to_object(JNIEnv *env, clayout_t *l, jbyte *p, jobject obj)
 {
-    jshort res;
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(&res, peer + index, sizeof(res));
-    return res;
+    jint i;
+
+    for (i = 0; i < l->nfields; i++) {
+        cfield_t *f = &l->fields[i];
+	jbyte *q = p + f->offset;
+
+#define GET_FIELD(jtype, Type)				\
+	{ jtype v; memcpy(&v, q, sizeof(v));		\
+	  env->Set##Type##Field(obj, f->fid, v); }
+	switch (f->type) {
+	case 'B': GET_FIELD(jbyte, Byte); break;
+	case 'S': GET_FIELD(jshort, Short); break;
+	case 'C': GET_FIELD(jchar, Char); break;
+	case 'I': GET_FIELD(jint, Int); break;
+	case 'J': GET_FIELD(jlong, Long); break;
+	case 'F': GET_FIELD(jfloat, Float); break;
+	case 'D': GET_FIELD(jdouble, Double); break;
+	case 'P': {
+	    void *v;
+	    memcpy(&v, q, sizeof(v));
+	    env->SetLongField(obj, f->fid, (jlong)v);
+	    break;
+	}
+	}
+#undef GET_FIELD
+    }
 }
 
-/*
- * Class:     CPointer
- * Method:    getString
- * Signature: (I)Ljava/lang/String;
- */
-JNIEXPORT jstring JNICALL Java_CPointer_getString
-  (JNIEnv *env, jobject self, jint index)
+/* Copy the fields of obj into one struct at p */
+static void
+object_to_struct(JNIEnv *env, clayout_t *l, jobject obj, jbyte *p)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    return JNU_NewStringNative(env, (const char *)peer + index);
+    jint i;
+
+    for (i = 0; i < l->nfields; i++) {
+        cfield_t *f = &l->fields[i];
+	jbyte *q = p + f->offset;
+
+#define PUT_FIELD(jtype, Type)				\
+	{ jtype v = env->Get##Type##Field(obj, f->fid);	\
+	  memcpy(q, &v, sizeof(v)); }
+	switch (f->type) {
+	case 'B': PUT_FIELD(jbyte, Byte); break;
+	case 'S': PUT_FIELD(jshort, Short); break;
+	case 'C': PUT_FIELD(jchar, Char); break;
+	case 'I': PUT_FIELD(jint, Int); break;
+	case 'J': PUT_FIELD(jlong, Long); break;
+	case 'F': PUT_FIELD(jfloat, Float); break;
+	case 'D': PUT_FIELD(jdouble, Double); break;
+	case 'P': {
+	    void *v = (void *)env->GetLongField(obj, f->fid);
+	    memcpy(q, &v, sizeof(v));
+	    break;
+	}
+	}
+#undef PUT_FIELD
+    }
 }
 
 /*
- * Class:     CPointer
- * Method:    setByte
- * Signature: (IB)V
+ * Class:     CStruct
+ * Method:    readObjects
+ * Signature: (JJ[Ljava/lang/Object;II)V
  */
-JNIEXPORT void JNICALL Java_CPointer_setByte
-  (JNIEnv *env, jobject self, jint index, jbyte value)
+JNIEXPORT void JNICALL Java_CStruct_readObjects
+  (JNIEnv *env, jclass cls, jlong plan, jlong addr, jobjectArray objs,
+   jint index, jint count)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(peer + index, &value, sizeof(value));
+    clayout_t *l = (clayout_t *)plan;
+    jbyte *p = (jbyte *)addr;
+    jint i;
+
+    for (i = 0; i < count; i++, p += l->size) {
+        jobject obj = env->GetObjectArrayElement(objs, index + i);
+	if (obj == NULL) {
+	    if (!env->ExceptionCheck()) {
+	        JNU_ThrowByName(env, "java/lang/NullPointerException", 0);
+	    }
+	    return;
+	}
+	/* the Java code checked, but the array may have changed since */
+	if (!env->IsInstanceOf(obj, l->cls)) {
+	    JNU_ThrowByName(env, "java/lang/ClassCastException", 0);
+	    return;
+	}
+	struct_to_object(env, l, p, obj);
+	env->DeleteLocalRef(obj);
+    }
 }
 
 /*
- * Class:     CPointer
- * Method:    setCPointer
- * Signature: (ILCPointer;)V
+ * Class:     CStruct
+ * Method:    writeObjects
+ * Signature: (JJ[Ljava/lang/Object;II)V
  */
-JNIEXPORT void JNICALL Java_CPointer_setCPointer
-  (JNIEnv *env, jobject self, jint index, jobject cptr)
+JNIEXPORT void JNICALL Java_CStruct_writeObjects
+  (JNIEnv *env, jclass cls, jlong plan, jlong addr, jobjectArray objs,
+   jint index, jint count)
 {
-    void *ptr = (void *)env->GetLongField(cptr, FID_CPointer_peer);
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(peer + index, &ptr, sizeof(ptr));
+    clayout_t *l = (clayout_t *)plan;
+    jbyte *p = (jbyte *)addr;
+    jint i;
+
+    for (i = 0; i < count; i++, p += l->size) {
+        jobject obj = env->GetObjectArrayElement(objs, index + i);
+	if (obj == NULL) {
+	    if (!env->ExceptionCheck()) {
+	        JNU_ThrowByName(env, "java/lang/NullPointerException", 0);
+	    }
+	    return;
+	}
+	if (!env->IsInstanceOf(obj, l->cls)) {
+	    JNU_ThrowByName(env, "java/lang/ClassCastException", 0);
+	    return;
+	}
+	object_to_struct(env, l, obj, p);
+	env->DeleteLocalRef(obj);
+    }
 }
 
 /*
- * Class:     CPointer
- * Method:    setDouble
- * Signature: (ID)V
+ * Class:     CStruct
+ * Method:    readObject
+ * Signature: (JJLjava/lang/Object;)V
  */
-JNIEXPORT void JNICALL Java_CPointer_setDouble
-  (JNIEnv *env, jobject self, jint index, jdouble value)
+JNIEXPORT void JNICALL Java_CStruct_readObject
+  (JNIEnv *env, jclass cls, jlong plan, jlong addr, jobject obj)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(peer + index, &value, sizeof(value));
+    struct_to_object(env, (clayout_t *)plan, (jbyte *)addr, obj);
 }
 
 /*
- * Class:     CPointer
- * Method:    setFloat
- * Signature: (IF)V
+ * Class:     CStruct
+ * Method:    writeObject
+ * Signature: (JJLjava/lang/Object;)V
  */
-JNIEXPORT void JNICALL Java_CPointer_setFloat
-  (JNIEnv *env, jobject self, jint index, jfloat value)
+JNIEXPORT void JNICALL Java_CStruct_writeObject
+  (JNIEnv *env, jclass cls, jlong plan, jlong addr, jobject obj)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(peer + index, &value, sizeof(value));
+    object_to_struct(env, (clayout_t *)plan, obj, (jbyte *)addr);
 }
 
 /*
- * Class:     CPointer
- * Method:    setInt
- * Signature: (II)V
+ * Copy count structs to or from primitive arrays.  Integer and pointer
+ * fields go to ints, floating point fields to floats, each struct's
+ * fields in order and then the next struct's.  The Java code has checked
+ * the array lengths.
  */
-JNIEXPORT void JNICALL Java_CPointer_setInt
-  (JNIEnv *env, jobject self, jint index, jint value)
+static void
+struct_values(JNIEnv *env, clayout_t *l, jbyte *p, jint count,
+	      jlongArray iarr, jdoubleArray farr, jboolean write)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(peer + index, &value, sizeof(value));
+    jlong *ints = NULL;
+    jdouble *floats = NULL;
+    jlong *ip;
+    jdouble *fp;
+    jint i, k;
+
+    if (l->nints > 0 &&
+	(ints = (jlong *)env->GetPrimitiveArrayCritical(iarr, 0)) == NULL) {
+        return;
+    }
+    if (l->nfloats > 0 &&
+	(floats = (jdouble *)env->GetPrimitiveArrayCritical(farr, 0)) == NULL) {
+        if (ints != NULL) {
+	    env->ReleasePrimitiveArrayCritical(iarr, ints, JNI_ABORT);
+	}
+        return;
+    }
+    for (ip = ints, fp = floats, i = 0; i < count; i++, p += l->size) {
+        for (k = 0; k < l->nfields; k++) {
+	    cfield_t *f = &l->fields[k];
+	    jbyte *q = p + f->offset;
+
+#define MOVE(jtype, slot, jslot)			\
+	    if (write) {				\
+	        jtype v = (jtype)*slot++;		\
+		memcpy(q, &v, sizeof(v));		\
+	    } else {					\
+	        jtype v;				\
+		memcpy(&v, q, sizeof(v));		\
+		*slot++ = (jslot)v;			\
+	    }
+	    switch (f->type) {
+	    case 'B': MOVE(jbyte, ip, jlong); break;
+	    case 'S': MOVE(jshort, ip, jlong); break;
+	    case 'C': MOVE(jchar, ip, jlong); break;
+	    case 'I': MOVE(jint, ip, jlong); break;
+	    case 'J': MOVE(jlong, ip, jlong); break;
+	    case 'P': MOVE(size_t, ip, jlong); break;
+	    case 'F': MOVE(jfloat, fp, jdouble); break;
+	    case 'D': MOVE(jdouble, fp, jdouble); break;
+	    }
+#undef MOVE
+	}
+    }
+    if (floats != NULL) {
+        env->ReleasePrimitiveArrayCritical(farr, floats, write ? JNI_ABORT : 0);
+    }
+    if (ints != NULL) {
+        env->ReleasePrimitiveArrayCritical(iarr, ints, write ? JNI_ABORT : 0);
+    }
 }
 
 /*
- * Class:     CPointer
- * Method:    setLong
- * Signature: (IJ)V
+ * Class:     CStruct
+ * Method:    readValues
+ * Signature: (JJI[J[D)V
  */
-JNIEXPORT void JNICALL Java_CPointer_setLong
-  (JNIEnv *env, jobject self, jint index, jlong value)
+JNIEXPORT void JNICALL Java_CStruct_readValues
+  (JNIEnv *env, jclass cls, jlong plan, jlong addr, jint count,
+   jlongArray ints, jdoubleArray floats)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(peer + index, &value, sizeof(value));
+    struct_values(env, (clayout_t *)plan, (jbyte *)addr, count,
+		  ints, floats, JNI_FALSE);
 }
 
 /*
- * Class:     CPointer
- * Method:    setShort
- * Signature: (IS)V
+ * Class:     CStruct
+ * Method:    writeValues
+ * Signature: (JJI[J[D)V
  */
-JNIEXPORT void JNICALL Java_CPointer_setShort
-  (JNIEnv *env, jobject self, jint index, jshort value)
+JNIEXPORT void JNICALL Java_CStruct_writeValues
+  (JNIEnv *env, jclass cls, jlong plan, jlong addr, jint count,
+   jlongArray ints, jdoubleArray floats)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    memcpy(peer + index, &value, sizeof(value));
+    struct_values(env, (clayout_t *)plan, (jbyte *)addr, count,
+		  ints, floats, JNI_TRUE);
 }
 
+/********************************************************************/
+/*		     Native methods of class CCallback		    */
+/********************************************************************/
+
 /*
- * Class:     CPointer
- * Method:    setString
- * Signature: (ILjava/lang/String;)V
+ * A callback slot: a Java method bound to a trampoline that C can call.
+ * Slots and their trampolines are made CB_BATCH at a time and never
+ * freed; closing a CCallback returns its slot to the free list, and the
+ * next CCallback reuses the trampoline as is.  The free list shares the
+ * CFunction class monitor with thunk generation, which allocates from
+ * the same executable arena.
  */
-JNIEXPORT void JNICALL Java_CPointer_setString
-  (JNIEnv *env, jobject self, jint index, jstring value)
+typedef struct cbslot {
+    int nwords;			/* these two are read by the backend */
+    char *argTypes;
+    void *code;			/* the trampoline */
+    callsig_t *sig;
+    jobject target;		/* global ref, NULL if the slot is free */
+    jmethodID mid;
+    struct cbslot *next;	/* next free slot */
+} cbslot_t;
+
+#define CB_BATCH 32
+
+static JavaVM *cb_vm;
+static cbslot_t *cb_free;	/* guarded by the CFunction class monitor */
+
+#ifdef DISPATCH_CALLBACKS
+/*
+ * Called through a trampoline, with the C arguments in a word array as
+ * laid out by dispatch().  The method ID was looked up when the callback
+ * was created, so a call costs the same as any cached upcall, plus an
+ * attach and detach if C calls from a thread the VM does not know.
+ * An exception thrown by the method stays pending until control returns
+ * to Java; C sees a zero result meanwhile, from that call and from any
+ * later ones, which do not call the method.
+ */
+extern "C" void
+callback_invoke(void *p, word_t *args, word_t *resP)
 {
-    jbyte *peer = (jbyte *)env->GetLongField(self, FID_CPointer_peer);
-    char *str = JNU_GetStringNativeChars(env, value);
-    if (str == NULL) return;
-    strcpy((char *)peer + index, str);
-    free(str);
+    cbslot_t *slot = (cbslot_t *)p;
+    callsig_t *sig = slot->sig;
+    JNIEnv *env;
+    jvalue jargs_buf[INLINE_NARGS];
+    jvalue *jargs = jargs_buf;
+    jboolean attached = JNI_FALSE;
+    scratch_mark_t mark = scratch;
+    int i, w;
+
+    memset(resP, 0, sizeof(jlong));
+    if (cb_vm->GetEnv((void **)&env, JNI_VERSION_1_2) != JNI_OK) {
+        if (cb_vm->AttachCurrentThread((void **)&env, NULL) != JNI_OK) {
+	    return;
+	}
+	attached = JNI_TRUE;
+    }
+    /* An earlier call threw, and C has not yet returned to Java; the
+       method must not run with the exception pending. */
+    if (env->ExceptionCheck()) {
+        goto done;
+    }
+    if (sig->nargs > INLINE_NARGS &&
+	(jargs = (jvalue *)scratch_alloc(sig->nargs * sizeof(jvalue)))
+	    == NULL) {
+        goto done;
+    }
+
+    for (w = i = 0; i < sig->nargs; i++) {
+        switch (sig->kinds[i]) {
+	case TY_INTEGER:
+	    jargs[i].i = args[w++].i;
+	    break;
+	case TY_CPTR:
+	    jargs[i].j = (jlong)args[w++].p;
+	    break;
+	case TY_FLOAT:
+	    jargs[i].f = args[w++].f;
+	    break;
+	case TY_DOUBLE:
+	    jargs[i].d = *(jdouble *)(args + w);
+	    w += sizeof(jdouble) / sizeof(word_t);
+	    break;
+	case TY_LONG:
+	    jargs[i].j = *(jlong *)(args + w);
+	    w += sizeof(jlong) / sizeof(word_t);
+	    break;
+	}
+    }
+
+    if (sig->is_void) {
+        env->CallVoidMethodA(slot->target, slot->mid, jargs);
+    } else {
+        switch (sig->res_ty) {
+	case TY_INTEGER:
+	    resP->i = env->CallIntMethodA(slot->target, slot->mid, jargs);
+	    break;
+	case TY_CPTR:
+	    resP->p = (void *)env->CallLongMethodA(slot->target, slot->mid,
+						   jargs);
+	    break;
+	case TY_LONG:
+	    *(jlong *)resP = env->CallLongMethodA(slot->target, slot->mid,
+						  jargs);
+	    break;
+	case TY_FLOAT:
+	    resP->f = env->CallFloatMethodA(slot->target, slot->mid, jargs);
+	    break;
+	default:
+	    *(jdouble *)resP = env->CallDoubleMethodA(slot->target,
+						      slot->mid, jargs);
+	    break;
+	}
+    }
+
+done:
+    scratch = mark;
+    if (attached) {
+        /* nobody is left to see it */
+        if (env->ExceptionCheck()) {
+	    env->ExceptionDescribe();
+	}
+        cb_vm->DetachCurrentThread();
+    }
 }
+#endif /* DISPATCH_CALLBACKS */
 
+/* JNI method descriptor for a callback signature, in malloc'ed memory */
+static char *
+cb_descriptor(callsig_t *sig)
+{
+    char *desc = (char *)malloc(sig->nargs + 4);
+    char *d = desc;
+    int i;
 
-/********************************************************************/
-/*		     Native methods of class CMalloc		    */
-/********************************************************************/
+    if (desc == NULL) {
+        return NULL;
+    }
+    *d++ = '(';
+    for (i = 0; i < sig->nargs; i++) {
+        switch (sig->kinds[i]) {
+	case TY_INTEGER: *d++ = 'I'; break;
+	case TY_FLOAT:   *d++ = 'F'; break;
+	case TY_DOUBLE:  *d++ = 'D'; break;
+	default:         *d++ = 'J'; break;	/* pointers are longs */
+	}
+    }
+    *d++ = ')';
+    if (sig->is_void) {
+        *d++ = 'V';
+    } else {
+        switch (sig->res_ty) {
+	case TY_INTEGER: *d++ = 'I'; break;
+	case TY_FLOAT:   *d++ = 'F'; break;
+	case TY_DOUBLE:  *d++ = 'D'; break;
+	default:         *d++ = 'J'; break;
+	}
+    }
+    *d = '\0';
+    return desc;
+}
 
 /*
- * Class:     CMalloc
- * Method:    malloc
- * Signature: (I)J
+ * Class:     CCallback
+ * Method:    initIDs
+ * Signature: ()V
  */
-JNIEXPORT jlong JNICALL Java_CMalloc_malloc
-  (JNIEnv *env, jclass cls, jint size)
+JNIEXPORT void JNICALL
+Java_CCallback_initIDs(JNIEnv *env, jclass cls)
 {
-    return (jlong)malloc(size);
+    if (env->GetJavaVM(&cb_vm) != 0) return;
+    FID_CCallback_slot = env->GetFieldID(cls, "slot", "J");
+    if (FID_CCallback_slot == NULL) return;
+    Class_CCallback = (jclass)env->NewGlobalRef(cls);
 }
 
 /*
- * Class:     CMalloc
- * Method:    free
+ * Class:     CCallback
+ * Method:    release
  * Signature: (J)V
  */
-JNIEXPORT void JNICALL Java_CMalloc_free
-  (JNIEnv *env, jobject self)
+JNIEXPORT void JNICALL Java_CCallback_release
+  (JNIEnv *env, jclass cls, jlong slotp)
 {
-    long peer = env->GetLongField(self, FID_CPointer_peer);
-    free((void *)peer);
+    cbslot_t *slot = (cbslot_t *)slotp;
+
+    if (slot->target != NULL) {
+        env->DeleteGlobalRef(slot->target);
+	slot->target = NULL;
+    }
+    if (env->MonitorEnter(Class_CFunction) != 0) {
+        return;
+    }
+    slot->next = cb_free;
+    cb_free = slot;
+    env->MonitorExit(Class_CFunction);
 }
 
+/*
+ * Class:     CCallback
+ * Method:    create
+ * Signature: (Ljava/lang/Object;Ljava/lang/String;J)V
+ */
+JNIEXPORT void JNICALL Java_CCallback_create
+  (JNIEnv *env, jobject self, jobject target, jstring name, jlong sigp)
+{
+#ifdef DISPATCH_CALLBACKS
+    callsig_t *sig = (callsig_t *)sigp;
+    cbslot_t *slot;
+    jclass cls;
+    jmethodID mid;
+    const char *cname;
+    char *desc;
+    int i;
+
+    /* look the method up first; it is the likely failure */
+    if ((desc = cb_descriptor(sig)) == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	return;
+    }
+    if ((cname = env->GetStringUTFChars(name, 0)) == NULL) {
+        free(desc);
+	return;
+    }
+    cls = env->GetObjectClass(target);
+    mid = env->GetMethodID(cls, cname, desc);
+    env->ReleaseStringUTFChars(name, cname);
+    env->DeleteLocalRef(cls);
+    free(desc);
+    if (mid == NULL) {
+        return; /* NoSuchMethodError already thrown */
+    }
+
+    if (env->MonitorEnter(Class_CFunction) != 0) {
+        return;
+    }
+    if (cb_free == NULL) {
+        cbslot_t *batch = (cbslot_t *)calloc(CB_BATCH, sizeof(cbslot_t));
+	for (i = 0; batch != NULL && i < CB_BATCH; i++) {
+	    if ((batch[i].code = asm_make_callback(&batch[i])) == NULL) {
+	        break;
+	    }
+	    batch[i].next = cb_free;
+	    cb_free = &batch[i];
+	}
+	if (batch != NULL && i == 0) {
+	    free(batch);
+	}
+    }
+    if ((slot = cb_free) != NULL) {
+        cb_free = slot->next;
+    }
+    env->MonitorExit(Class_CFunction);
+    if (slot == NULL) {
+        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+	return;
+    }
+
+    slot->nwords = sig->nwords;
+    slot->argTypes = sig->argTypes;
+    slot->sig = sig;
+    slot->mid = mid;
+    if ((slot->target = env->NewGlobalRef(target)) == NULL) {
+        Java_CCallback_release(env, Class_CCallback, (jlong)slot);
+	return;
+    }
+    env->SetLongField(self, FID_CCallback_slot, (jlong)slot);
+    env->SetLongField(self, FID_CPointer_peer, (jlong)slot->code);
+#else
+    JNU_ThrowByName(env, "java/lang/UnsupportedOperationException",
+		    "callbacks are only supported on x86-64");
+#endif
+}
 
 /********************************************************************/
 /*			   Utility functions			    */
@@ -837,6 +3525,7 @@ JNU_ThrowByName(JNIEnv *env, const char *name, const char *msg)
     env->DeleteLocalRef(cls);
 }
 
+#ifdef JNI_BOOK
 /* Translates a Java string to a C string using the String.getBytes 
  * method, which uses default local encoding.
  */
@@ -866,17 +3555,300 @@ JNU_GetStringNativeChars(JNIEnv *env, jstring jstr)
     return result;
 }
 
-/* Constructs a Java string from a C array using the String(byte [])
- * constructor, which uses default local encoding.
+#endif /* JNI_BOOK */
+
+/* Frees the overflow chunks of the exiting thread; the thread-local
+ * chunk goes with the thread.
+ */
+static void THREAD_EXIT_CALL
+scratch_free(void *unused)
+{
+    scratch_chunk_t *c = scratch0.hdr.next, *next;
+
+    for (; c != NULL; c = next) {
+        next = c->next;
+	free(c);
+    }
+    scratch0.hdr.next = NULL;
+    scratch.chunk = NULL;
+    scratch.used = scratch.depth = 0;
+}
+
+JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM *vm, void *reserved)
+{
+    scratch_keyed = THREAD_KEY_CREATE(scratch_key, scratch_free);
+    return JNI_VERSION_1_2;
+}
+
+/* Allocates size bytes, 8-byte aligned, from the current thread's
+ * scratch arena.  Returns NULL if out of memory.
+ */
+static void *
+scratch_alloc(size_t size)
+{
+    scratch_chunk_t *c = scratch.chunk;
+    void *p;
+
+    size = (size + 7) & ~(size_t)7;
+    if (c == NULL) {
+        c = scratch.chunk = &scratch0.hdr;
+	c->size = SCRATCH_SIZE - SCRATCH_HDR;
+    }
+    while (scratch.used + size > c->size) {
+        /* Move on to the next chunk, putting in a bigger one if the
+	   next one is missing or too small. */
+        if (c->next == NULL || c->next->size < size) {
+	    size_t csize = c->size * 2 > size ? c->size * 2 : size;
+	    scratch_chunk_t *nc = (scratch_chunk_t *)
+	        malloc(SCRATCH_HDR + csize);
+	    if (nc == NULL) {
+	        return NULL;
+	    }
+	    if (scratch0.hdr.next == NULL && scratch_keyed) {
+	        /* first overflow chunk on this thread */
+	        THREAD_KEY_SET(scratch_key, &scratch0);
+	    }
+	    nc->size = csize;
+	    nc->next = c->next;
+	    c->next = nc;
+	}
+	c = scratch.chunk = c->next;
+	scratch.used = 0;
+    }
+    p = (char *)c + SCRATCH_HDR + scratch.used;
+    scratch.used += size;
+    scratch.depth += size;
+    /* racy, but only ever a statistic */
+    if (scratch.depth > scratch_high_water) {
+        scratch_high_water = scratch.depth;
+    }
+    return p;
+}
+
+/* Returns the length of the ASCII prefix of the n bytes at s */
+static size_t
+asciiPrefix(const char *s, size_t n)
+{
+    size_t i = 0;
+#ifdef DISPATCH_SSE2
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+	if (_mm_movemask_epi8(v) != 0) {
+	    break; /* the loop below finds the byte */
+	}
+    }
+#endif
+    while (i < n && !(s[i] & 0x80)) {
+        i++;
+    }
+    return i;
+}
+
+/* Copies the ASCII prefix of the n chars at s to dst, one byte per
+ * char, and returns its length.
+ */
+static jsize
+narrowAscii(const jchar *s, jsize n, char *dst)
+{
+    jsize i = 0;
+#ifdef DISPATCH_SSE2
+    const __m128i high = _mm_set1_epi16((short)0xff80);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+	__m128i b = _mm_loadu_si128((const __m128i *)(s + i + 8));
+	__m128i t = _mm_and_si128(_mm_or_si128(a, b), high);
+	if (_mm_movemask_epi8(_mm_cmpeq_epi16(t, zero)) != 0xffff) {
+	    break;
+	}
+	_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+#endif
+    for (; i < n && s[i] < 0x80; i++) {
+        dst[i] = (char)s[i];
+    }
+    return i;
+}
+
+/* Decodes n bytes of UTF-8 into buf, which has room for n chars, and
+ * returns the number of chars.  As in String(byte []), each maximal
+ * prefix of a valid sequence that is cut short, and each byte that
+ * starts none, becomes one U+FFFD.
+ */
+static jsize
+decodeUTF8(const unsigned char *s, jsize n, jchar *buf)
+{
+    jsize i = 0, j, k = 0;
+
+    while (i < n) {
+        unsigned int c = s[i], cp, lo = 0x80, hi = 0xbf;
+	int extra;
+
+	if (c < 0x80) {
+	    buf[k++] = (jchar)c;
+	    i++;
+	    continue;
+	}
+	/* The range of the second byte rules out overlong forms,
+	   surrogates and code points above U+10FFFF. */
+	if (c >= 0xc2 && c < 0xe0) {
+	    extra = 1; cp = c & 0x1f;
+	} else if (c >= 0xe0 && c < 0xf0) {
+	    extra = 2; cp = c & 0x0f;
+	    if (c == 0xe0) lo = 0xa0;
+	    if (c == 0xed) hi = 0x9f;
+	} else if (c >= 0xf0 && c < 0xf5) {
+	    extra = 3; cp = c & 0x07;
+	    if (c == 0xf0) lo = 0x90;
+	    if (c == 0xf4) hi = 0x8f;
+	} else {
+	    buf[k++] = 0xfffd;
+	    i++;
+	    continue;
+	}
+	for (j = 1; j <= extra && i + j < n; j++) {
+	    if (s[i + j] < lo || s[i + j] > hi) {
+	        break; /* decoding resumes at this byte */
+	    }
+	    cp = (cp << 6) | (s[i + j] & 0x3f);
+	    lo = 0x80;
+	    hi = 0xbf;
+	}
+	i += j;
+	if (j <= extra) {
+	    buf[k++] = 0xfffd;
+	} else if (cp >= 0x10000) {
+	    cp -= 0x10000;
+	    buf[k++] = (jchar)(0xd800 + (cp >> 10));
+	    buf[k++] = (jchar)(0xdc00 + (cp & 0x3ff));
+	} else {
+	    buf[k++] = (jchar)cp;
+	}
+    }
+    return k;
+}
+
+/* Translates a Java string to a C string in the platform encoding,
+ * allocated from the scratch arena; the caller releases it by
+ * restoring a scratch mark.  Returns NULL with an exception pending on
+ * failure.
+ *
+ * When the platform encoding allows it, the string is converted
+ * without calling back into Java: ASCII strings in any ASCII compatible
+ * encoding, and strings without supplementary characters or NUL in
+ * UTF-8 (the JNI's modified UTF-8 differs from UTF-8 only for those).
+ * Everything else goes through String.getBytes.
+ */
+static char *
+getStringScratchChars(JNIEnv *env, jstring jstr)
+{
+    scratch_mark_t mark = scratch;
+    const jchar *chars;
+    jsize i, len, ascii;
+    jchar bits = 0;
+    int same_utf;
+    jbyteArray hab;
+    char *buf;
+
+    if (native_encoding != ENC_OTHER) {
+        len = env->GetStringLength(jstr);
+	if ((buf = (char *)scratch_alloc(len + 1)) == NULL) {
+	    goto nomem;
+	}
+
+	/* Narrow while scanning; only used if everything was ASCII */
+	chars = env->GetStringCritical(jstr, 0);
+	if (chars == 0) {
+	    scratch = mark;
+	    return 0; /* OutOfMemoryError already thrown */
+	}
+	ascii = narrowAscii(chars, len, buf);
+	for (i = ascii; i < len; i++) {
+	    jchar c = chars[i];
+	    if (c == 0 || (c >= 0xd800 && c < 0xe000)) {
+	        break;
+	    }
+	    bits |= c;
+	    buf[i] = (char)c;
+	}
+	env->ReleaseStringCritical(jstr, chars);
+
+	if (i == len && bits < 0x80) {
+	    buf[len] = 0;
+	    return buf;
+	}
+	/* The loop stops at NUL and surrogates; the prefix may hold NUL,
+	   which is C0 80 in modified UTF-8 but a 0 byte in UTF-8 */
+	same_utf = i == len && memchr(buf, 0, ascii) == NULL;
+	scratch = mark;
+	if (same_utf && native_encoding == ENC_UTF8) {
+	    jsize utflen = env->GetStringUTFLength(jstr);
+	    if ((buf = (char *)scratch_alloc(utflen + 1)) == NULL) {
+	        goto nomem;
+	    }
+	    env->GetStringUTFRegion(jstr, 0, len, buf);
+	    buf[utflen] = 0;
+	    return buf;
+	}
+    }
+
+    hab = (jbyteArray)env->CallObjectMethod(jstr, MID_String_getBytes);
+    if (env->ExceptionCheck()) {
+        return 0;
+    }
+    len = env->GetArrayLength(hab);
+    if ((buf = (char *)scratch_alloc(len + 1)) == NULL) {
+        env->DeleteLocalRef(hab);
+	goto nomem;
+    }
+    env->GetByteArrayRegion(hab, 0, len, (jbyte *)buf);
+    buf[len] = 0; /* NULL-terminate */
+    env->DeleteLocalRef(hab);
+    return buf;
+
+nomem:
+    scratch = mark;
+    JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+    return 0;
+}
+
+/* Constructs a Java string from a C string in the platform encoding.
+ * ASCII strings, in any ASCII compatible encoding, and UTF-8 are
+ * converted without calling back into Java; anything else uses the
+ * String(byte []) constructor, which uses default local encoding.
  */
 static jstring
 JNU_NewStringNative(JNIEnv *env, const char *str)
 {
+    scratch_mark_t mark = scratch;
     jstring result;
     jbyteArray hab = 0;
+    jchar *chars;
+    size_t ascii;
     int len;
 
     len = strlen(str);
+    if (native_encoding != ENC_OTHER) {
+        ascii = asciiPrefix(str, len);
+	if (ascii == (size_t)len) {
+	    /* ASCII is also modified UTF-8 */
+	    return env->NewStringUTF(str);
+	}
+	if (native_encoding == ENC_UTF8) {
+	    chars = (jchar *)scratch_alloc((size_t)len * sizeof(jchar));
+	    if (chars == NULL) {
+	        JNU_ThrowByName(env, "java/lang/OutOfMemoryError", 0);
+		return 0;
+	    }
+	    result = env->NewString(chars,
+	        decodeUTF8((const unsigned char *)str, len, chars));
+	    scratch = mark;
+	    return result;
+	}
+    }
+
     hab = env->NewByteArray(len);
     if (hab != 0) {
         env->SetByteArrayRegion(hab, 0, len, (jbyte *)str);
@@ -0,0 +1,526 @@
+/*
+ * %W% %E%
+ *
+ * Copyright (c) 1998 Sun Microsystems, Inc. All Rights Reserved.
+ *
+ * See also the LICENSE file in this distribution.
+ */
+
+/*
+ * x86-64 (System V AMD64 ABI) specific parts of dispatch.cpp, for
+ * Linux and other ELF platforms compiled with gcc.
+ *
+ * Unlike the 32-bit x86 and SPARC versions, the arguments cannot
+ * simply be copied to the C stack word by word: integer and pointer
+ * arguments go in rdi, rsi, rdx, rcx, r8 and r9, floating point
+ * arguments go in xmm0 through xmm7, and only what does not fit is
+ * passed on the stack.  asm_dispatch sorts the words into these three
+ * classes in C, and amd64_call (below) loads the registers, calls the
+ * function and saves the registers that may hold the result.
+ *
+ * Structs passed by value arrive as runs of TY_SWORD_INT and
+ * TY_SWORD_FLT words, classified the way the ABI classifies eightbytes.
+ * A struct of one or two words goes in registers if there are enough
+ * left for all of its words, and otherwise entirely on the stack, as
+ * does any bigger struct.  Struct results come back the same way, or
+ * through a hidden pointer in rdi when they are bigger than 16 bytes.
+ */
+
+#include <string.h>
+
+/* Argument and result types; must agree with ty_t in dispatch.cpp */
+#define TY_CPTR    0
+#define TY_INTEGER 1
+#define TY_FLOAT   2
+#define TY_DOUBLE  3
+#define TY_DOUBLE2 4
+#define TY_STRING  5
+#define TY_SWORD_INT 6
+#define TY_SWORD_FLT 7
+#define TY_STRUCT  8
+#define TY_LONG    9
+#define TY_SFIRST  0x40
+
+/* represent a machine word; must agree with word_t in dispatch.cpp */
+typedef union {
+    int i;
+    float f;
+    double d;
+    long l;
+    void *p;
+} word_t;
+
+/* struct result; must agree with sret_t in dispatch.cpp */
+typedef struct {
+    void *dest;
+    int size;
+    int nwords;
+    char types[2];
+} sret_t;
+
+#define N_GP  6			/* integer argument registers */
+#define N_SSE 8			/* vector argument registers */
+
+/* Register image handed to amd64_call.  The offsets are hard coded in
+ * the assembly code below; keep the two in sync.
+ */
+typedef struct {
+    long gp[N_GP];		/*   0: rdi, rsi, rdx, rcx, r8, r9 */
+    double sse[N_SSE];		/*  48: xmm0 - xmm7 */
+    long nsse;			/* 112: copied to al for varargs callees */
+    long nstack;		/* 120: number of stack words */
+    long *stack;		/* 128: stack words, first argument first */
+    long rax;			/* 136: results */
+    long rdx;			/* 144 */
+    double xmm0;		/* 152 */
+    double xmm1;		/* 160 */
+} amd64_frame_t;
+
+void amd64_call(void *func, amd64_frame_t *frame);
+
+__asm__(
+    "	.text\n"
+    "	.p2align 4\n"
+    "	.type	amd64_call, @function\n"
+    "amd64_call:\n"
+    "	pushq	%rbp\n"
+    "	movq	%rsp, %rbp\n"
+    "	pushq	%rbx\n"
+    "	subq	$8, %rsp\n"
+    "	movq	%rdi, %r11\n"		/* function */
+    "	movq	%rsi, %rbx\n"		/* frame, preserved across call */
+
+    /* Make room for the stack arguments; rsp must be 16-byte aligned
+       at the call instruction. */
+    "	movq	120(%rbx), %rcx\n"
+    "	leaq	(,%rcx,8), %rax\n"
+    "	subq	%rax, %rsp\n"
+    "	andq	$-16, %rsp\n"
+    "	movq	128(%rbx), %rsi\n"
+    "	xorl	%edx, %edx\n"
+    "1:	cmpq	%rcx, %rdx\n"
+    "	jge	2f\n"
+    "	movq	(%rsi,%rdx,8), %rax\n"
+    "	movq	%rax, (%rsp,%rdx,8)\n"
+    "	incq	%rdx\n"
+    "	jmp	1b\n"
+    "2:\n"
+    "	movsd	48(%rbx), %xmm0\n"
+    "	movsd	56(%rbx), %xmm1\n"
+    "	movsd	64(%rbx), %xmm2\n"
+    "	movsd	72(%rbx), %xmm3\n"
+    "	movsd	80(%rbx), %xmm4\n"
+    "	movsd	88(%rbx), %xmm5\n"
+    "	movsd	96(%rbx), %xmm6\n"
+    "	movsd	104(%rbx), %xmm7\n"
+    "	movq	0(%rbx), %rdi\n"
+    "	movq	8(%rbx), %rsi\n"
+    "	movq	16(%rbx), %rdx\n"
+    "	movq	24(%rbx), %rcx\n"
+    "	movq	32(%rbx), %r8\n"
+    "	movq	40(%rbx), %r9\n"
+    "	movq	112(%rbx), %rax\n"
+    "	call	*%r11\n"
+
+    "	movq	%rax, 136(%rbx)\n"
+    "	movq	%rdx, 144(%rbx)\n"
+    "	movsd	%xmm0, 152(%rbx)\n"
+    "	movsd	%xmm1, 160(%rbx)\n"
+    "	movq	-8(%rbp), %rbx\n"
+    "	leave\n"
+    "	ret\n"
+    "	.size	amd64_call, .-amd64_call\n"
+);
+
+/*
+ * Classifies the arguments from the given array into registers and C
+ * stack, invoke the target function, and copy the result back.  The
+ * calling convention is ignored: x86-64 has only one.
+ */
+void asm_dispatch(void *func,
+		  int nwords,
+		  char *arg_types,
+		  word_t *args,
+		  int res_type,
+		  word_t *resP,
+		  int conv)
+{
+    amd64_frame_t frame;
+    long stack[nwords + 1];
+    int i, ngp = 0;
+    sret_t *sret = res_type == TY_STRUCT ? (sret_t *)resP : NULL;
+
+    frame.nsse = 0;
+    frame.nstack = 0;
+    frame.stack = stack;
+
+    if (sret != NULL && sret->nwords > 2) {
+        frame.gp[ngp++] = (long)sret->dest;
+    }
+
+    for (i = 0; i < nwords; i++) {
+        if (arg_types[i] & TY_SFIRST) {
+	    /* a struct: all in registers or all on the stack */
+	    int n = 1, need_gp = 0, need_sse = 0, k;
+	    while (i + n < nwords && (arg_types[i + n] == TY_SWORD_INT ||
+				      arg_types[i + n] == TY_SWORD_FLT)) {
+	        n++;
+	    }
+	    for (k = 0; k < n; k++) {
+	        if ((arg_types[i + k] & ~TY_SFIRST) == TY_SWORD_FLT) {
+		    need_sse++;
+		} else {
+		    need_gp++;
+		}
+	    }
+	    if (n <= 2 && ngp + need_gp <= N_GP &&
+		frame.nsse + need_sse <= N_SSE) {
+	        for (k = 0; k < n; k++) {
+		    if ((arg_types[i + k] & ~TY_SFIRST) == TY_SWORD_FLT) {
+		        frame.sse[frame.nsse++] = args[i + k].d;
+		    } else {
+		        frame.gp[ngp++] = args[i + k].l;
+		    }
+		}
+	    } else {
+	        for (k = 0; k < n; k++) {
+		    stack[frame.nstack++] = args[i + k].l;
+		}
+	    }
+	    i += n - 1;
+	    continue;
+	}
+        switch (arg_types[i]) {
+	case TY_FLOAT:
+	case TY_DOUBLE:
+	    if (frame.nsse < N_SSE) {
+	        frame.sse[frame.nsse++] = args[i].d;
+	    } else {
+	        stack[frame.nstack++] = args[i].l;
+	    }
+	    break;
+	case TY_INTEGER:
+	    /* only the low 32 bits of the word were set */
+	    if (ngp < N_GP) {
+	        frame.gp[ngp++] = args[i].i;
+	    } else {
+	        stack[frame.nstack++] = args[i].i;
+	    }
+	    break;
+	default:
+	    if (ngp < N_GP) {
+	        frame.gp[ngp++] = args[i].l;
+	    } else {
+	        stack[frame.nstack++] = args[i].l;
+	    }
+	    break;
+	}
+    }
+
+    amd64_call(func, &frame);
+
+    switch (res_type) {
+    case TY_CPTR:
+    case TY_LONG:
+        resP->l = frame.rax;
+	break;
+    case TY_INTEGER:
+        resP->i = (int)frame.rax;
+	break;
+    case TY_FLOAT:
+        memcpy(&resP->f, &frame.xmm0, sizeof(float));
+	break;
+    case TY_STRUCT:
+        if (sret->nwords <= 2) {
+	    /* rax and rdx in turn for integer words, xmm0 and xmm1 for
+	       float words */
+	    long gp[2], words[2];
+	    double sse[2];
+	    int k, g = 0, f = 0;
+	    gp[0] = frame.rax;
+	    gp[1] = frame.rdx;
+	    sse[0] = frame.xmm0;
+	    sse[1] = frame.xmm1;
+	    for (k = 0; k < sret->nwords; k++) {
+	        if ((sret->types[k] & ~TY_SFIRST) == TY_SWORD_FLT) {
+		    memcpy(&words[k], &sse[f++], sizeof(long));
+		} else {
+		    words[k] = gp[g++];
+		}
+	    }
+	    memcpy(sret->dest, words, sret->size);
+	}
+	break;
+    default:
+        resP->d = frame.xmm0;
+	break;
+    }
+}
+
+/*
+ * Executable memory for call thunks and callback trampolines.  The
+ * arena is never freed: there is one thunk per distinct signature and
+ * trampolines are recycled, so it stays small.  Not thread safe;
+ * callers serialize on the CFunction class monitor.
+ */
+
+#include <sys/mman.h>
+
+#define ARENA_SIZE (64 * 1024)
+
+static unsigned char *arena;	/* current chunk */
+static size_t arena_left;	/* bytes left in it */
+
+static unsigned char *
+arena_alloc(size_t size)
+{
+    unsigned char *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (size > arena_left) {
+        size_t chunk = size > ARENA_SIZE ? size : ARENA_SIZE;
+	p = (unsigned char *)mmap(NULL, chunk,
+				  PROT_READ | PROT_WRITE | PROT_EXEC,
+				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == (unsigned char *)MAP_FAILED) {
+	    return NULL;
+	}
+	arena = p;
+	arena_left = chunk;
+    }
+    p = arena;
+    arena += size;
+    arena_left -= size;
+    return p;
+}
+
+#ifdef DISPATCH_THUNKS
+
+/*
+ * Call thunks.  For a fixed signature, the classification done by
+ * asm_dispatch above is the same on every call, so we can do it once
+ * and emit straight-line code that loads each word into its register
+ * or stack slot, calls the function, and stores the result:
+ *
+ *	void thunk(void *func, word_t *args, word_t *resP);
+ */
+
+static unsigned char *
+emit_imm32(unsigned char *pc, int imm)
+{
+    memcpy(pc, &imm, 4);
+    return pc + 4;
+}
+
+/* Encoding of rdi, rsi, rdx, rcx, r8, r9 */
+static const int gp_regs[N_GP] = { 7, 6, 2, 1, 8, 9 };
+
+/*
+ * Emit a thunk for the given argument and result types.  Returns NULL
+ * if no executable memory is available; the caller should then keep
+ * using asm_dispatch.  Not thread safe; callers serialize.
+ */
+void *
+asm_make_thunk(int nwords, char *arg_types, int res_type)
+{
+    unsigned char *code, *pc;
+    int i, ngp = 0, nsse = 0, nstack = 0, frame;
+
+    /* prologue and epilogue take < 64 bytes, each word < 16 */
+    if ((code = arena_alloc(64 + 16 * nwords)) == NULL) {
+        return NULL;
+    }
+
+    /* count the stack words first to size the frame */
+    for (i = 0; i < nwords; i++) {
+        if (arg_types[i] == TY_FLOAT || arg_types[i] == TY_DOUBLE) {
+	    if (nsse++ >= N_SSE) nstack++;
+	} else {
+	    if (ngp++ >= N_GP) nstack++;
+	}
+    }
+    /* rsp is 8 mod 16 after pushing rbp and rbx */
+    frame = ((nstack * 8 + 15) & ~15) + 8;
+
+    pc = code;
+    *pc++ = 0x55;				/* push rbp */
+    *pc++ = 0x48; *pc++ = 0x89; *pc++ = 0xe5;	/* mov rbp, rsp */
+    *pc++ = 0x53;				/* push rbx */
+    *pc++ = 0x49; *pc++ = 0x89; *pc++ = 0xfb;	/* mov r11, rdi */
+    *pc++ = 0x49; *pc++ = 0x89; *pc++ = 0xf2;	/* mov r10, rsi */
+    *pc++ = 0x48; *pc++ = 0x89; *pc++ = 0xd3;	/* mov rbx, rdx */
+    *pc++ = 0x48; *pc++ = 0x81; *pc++ = 0xec;	/* sub rsp, frame */
+    pc = emit_imm32(pc, frame);
+
+    /* Stack words first, through rax, then the vector registers, and
+       the integer registers last since rsi and rdx are among them. */
+    ngp = nsse = nstack = 0;
+    for (i = 0; i < nwords; i++) {
+        int fp = arg_types[i] == TY_FLOAT || arg_types[i] == TY_DOUBLE;
+	if (fp ? nsse++ < N_SSE : ngp++ < N_GP) {
+	    continue;
+	}
+	if (arg_types[i] == TY_INTEGER) {
+	    *pc++ = 0x49; *pc++ = 0x63; *pc++ = 0x82;	/* movsxd rax, */
+	} else {
+	    *pc++ = 0x49; *pc++ = 0x8b; *pc++ = 0x82;	/* mov rax, */
+	}
+	pc = emit_imm32(pc, i * 8);			/*   [r10+i*8] */
+	*pc++ = 0x48; *pc++ = 0x89; *pc++ = 0x84; *pc++ = 0x24;
+	pc = emit_imm32(pc, nstack++ * 8);		/* mov [rsp+n], rax */
+    }
+    ngp = nsse = 0;
+    for (i = 0; i < nwords; i++) {
+        int reg;
+	if (arg_types[i] == TY_FLOAT || arg_types[i] == TY_DOUBLE) {
+	    if (nsse >= N_SSE) continue;
+	    reg = nsse++;
+	    *pc++ = 0xf2; *pc++ = 0x41; *pc++ = 0x0f; *pc++ = 0x10;
+	    *pc++ = 0x82 | (reg << 3);		/* movsd xmmN, [r10+i*8] */
+	    pc = emit_imm32(pc, i * 8);
+	}
+    }
+    for (i = 0; i < nwords; i++) {
+        int reg;
+	if (arg_types[i] == TY_FLOAT || arg_types[i] == TY_DOUBLE ||
+	    ngp >= N_GP) {
+	    continue;
+	}
+	reg = gp_regs[ngp++];
+	*pc++ = 0x49 | ((reg >> 3) << 2);	/* REX.W + REX.B (+ REX.R) */
+	*pc++ = arg_types[i] == TY_INTEGER ? 0x63 : 0x8b;
+	*pc++ = 0x82 | ((reg & 7) << 3);	/* reg, [r10+i*8] */
+	pc = emit_imm32(pc, i * 8);
+    }
+
+    *pc++ = 0xb8;				/* mov eax, nsse */
+    pc = emit_imm32(pc, nsse);
+    *pc++ = 0x41; *pc++ = 0xff; *pc++ = 0xd3;	/* call r11 */
+
+    switch (res_type) {
+    case TY_CPTR:
+    case TY_LONG:
+        *pc++ = 0x48; *pc++ = 0x89; *pc++ = 0x03;	/* mov [rbx], rax */
+	break;
+    case TY_INTEGER:
+        *pc++ = 0x89; *pc++ = 0x03;			/* mov [rbx], eax */
+	break;
+    case TY_FLOAT:
+        *pc++ = 0xf3; *pc++ = 0x0f; *pc++ = 0x11; *pc++ = 0x03;
+	break;						/* movss [rbx], xmm0 */
+    default:
+        *pc++ = 0xf2; *pc++ = 0x0f; *pc++ = 0x11; *pc++ = 0x03;
+	break;						/* movsd [rbx], xmm0 */
+    }
+    *pc++ = 0x48; *pc++ = 0x8b; *pc++ = 0x5d; *pc++ = 0xf8; /* mov rbx, [rbp-8] */
+    *pc++ = 0xc9;				/* leave */
+    *pc++ = 0xc3;				/* ret */
+
+    return code;
+}
+
+#endif /* DISPATCH_THUNKS */
+
+/*
+ * Callback trampolines, which let C call a Java method through a
+ * plain function pointer.  Each trampoline is a few instructions bound
+ * to one callback slot in dispatch.cpp:
+ *
+ *	mov r10, slot
+ *	mov r11, amd64_callback_entry
+ *	jmp r11
+ *
+ * amd64_callback_entry saves the argument registers, and
+ * amd64_callback sorts them and any stack arguments back into a word
+ * array, in argument order, for callback_invoke to convert and pass to
+ * Java.  The result comes back through a word that is loaded into both
+ * rax and xmm0, so it serves every return type.
+ */
+
+/* The start of a callback slot; must agree with cbslot_t in dispatch.cpp */
+typedef struct {
+    int nwords;
+    char *arg_types;
+} cbhdr_t;
+
+extern void callback_invoke(void *slot, word_t *args, word_t *resP);
+
+void amd64_callback(cbhdr_t *slot, long *regs, long *stack, word_t *res)
+    __attribute__((visibility("hidden")));
+void amd64_callback_entry(void);
+
+__asm__(
+    "	.text\n"
+    "	.p2align 4\n"
+    "	.type	amd64_callback_entry, @function\n"
+    "amd64_callback_entry:\n"
+    "	pushq	%rbp\n"
+    "	movq	%rsp, %rbp\n"
+    "	subq	$128, %rsp\n"		/* 6 + 8 registers, result, pad */
+    "	movq	%rdi, 0(%rsp)\n"
+    "	movq	%rsi, 8(%rsp)\n"
+    "	movq	%rdx, 16(%rsp)\n"
+    "	movq	%rcx, 24(%rsp)\n"
+    "	movq	%r8, 32(%rsp)\n"
+    "	movq	%r9, 40(%rsp)\n"
+    "	movsd	%xmm0, 48(%rsp)\n"
+    "	movsd	%xmm1, 56(%rsp)\n"
+    "	movsd	%xmm2, 64(%rsp)\n"
+    "	movsd	%xmm3, 72(%rsp)\n"
+    "	movsd	%xmm4, 80(%rsp)\n"
+    "	movsd	%xmm5, 88(%rsp)\n"
+    "	movsd	%xmm6, 96(%rsp)\n"
+    "	movsd	%xmm7, 104(%rsp)\n"
+    "	movq	$0, 112(%rsp)\n"
+    "	movq	%r10, %rdi\n"		/* slot */
+    "	movq	%rsp, %rsi\n"		/* registers */
+    "	leaq	16(%rbp), %rdx\n"	/* stack arguments */
+    "	leaq	112(%rsp), %rcx\n"	/* result */
+    "	call	amd64_callback\n"
+    "	movq	112(%rsp), %rax\n"
+    "	movsd	112(%rsp), %xmm0\n"
+    "	leave\n"
+    "	ret\n"
+    "	.size	amd64_callback_entry, .-amd64_callback_entry\n"
+);
+
+void
+amd64_callback(cbhdr_t *slot, long *regs, long *stack, word_t *res)
+{
+    word_t args[slot->nwords + 1];
+    int i, ngp = 0, nsse = 0;
+
+    for (i = 0; i < slot->nwords; i++) {
+        if (slot->arg_types[i] == TY_FLOAT ||
+	    slot->arg_types[i] == TY_DOUBLE) {
+	    args[i].l = nsse < N_SSE ? regs[N_GP + nsse++] : *stack++;
+	} else {
+	    args[i].l = ngp < N_GP ? regs[ngp++] : *stack++;
+	}
+    }
+    callback_invoke(slot, args, res);
+}
+
+/*
+ * Emit a trampoline for a callback slot.  Returns NULL if no executable
+ * memory is available.  Not thread safe; callers serialize.
+ */
+void *
+asm_make_callback(void *slot)
+{
+    unsigned char *code, *pc;
+    void *entry = (void *)amd64_callback_entry;
+
+    if ((code = arena_alloc(32)) == NULL) {
+        return NULL;
+    }
+    pc = code;
+    *pc++ = 0x49; *pc++ = 0xba;			/* mov r10, slot */
+    memcpy(pc, &slot, 8);
+    pc += 8;
+    *pc++ = 0x49; *pc++ = 0xbb;			/* mov r11, entry */
+    memcpy(pc, &entry, 8);
+    pc += 8;
+    *pc++ = 0x41; *pc++ = 0xff; *pc++ = 0xe3;	/* jmp r11 */
+    return code;
+}
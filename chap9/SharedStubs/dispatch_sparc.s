@@ -22,7 +22,8 @@
 !
 ! i0		function
 ! i1		# of words in arguments
-! i2		argument types, ignored
+! i2		argument types, ignored; longs and doubles are two words,
+!		high word first
 ! i3		arguments
 ! i4		return type
 ! i5		address to store return value
@@ -125,11 +126,27 @@ ret_p64:
 	ret
         restore %g0,%g0,%o0
 
+ret_i64:			! high word in o0, low word in o1
+	st	%o0,[%i5]
+	st	%o1,[%i5 + 4]
+	ret
+        restore %g0,%g0,%o0
+
+! Indexed by ty_t in dispatch.cpp.  Types that are never returned, or
+! that dispatch.cpp does not support on SPARC (struct results), share
+! ret_i32.
+
 ret_jumps:		
-	.word	ret_p64
-	.word	ret_i32
-	.word	ret_f32
-	.word	ret_f64
+	.word	ret_p64		! TY_CPTR
+	.word	ret_i32		! TY_INTEGER
+	.word	ret_f32		! TY_FLOAT
+	.word	ret_f64		! TY_DOUBLE
+	.word	ret_i32		! TY_DOUBLE2
+	.word	ret_i32		! TY_STRING
+	.word	ret_i32		! TY_SWORD_INT
+	.word	ret_i32		! TY_SWORD_FLT
+	.word	ret_i32		! TY_STRUCT
+	.word	ret_i64		! TY_LONG
 
 	.type	asm_dispatch,2
 	.size	asm_dispatch,(.-asm_dispatch)
@@ -14,6 +14,8 @@
  * asm_dispatch implementation described in the JNI book.
  */
 
+#include <string.h>
+
 #ifdef JNI_BOOK
 
 int asm_dispatch_int(void *func,  // pointer to the C function
@@ -56,9 +58,26 @@ int asm_dispatch_int(void *func,  // pointer to the C function
 
 #endif /* JNI_BOOK */
 
+/* Must agree with ty_t and sret_t in dispatch.cpp */
+#define TY_STRUCT 8
+#define TY_LONG   9
+
+typedef struct {
+    void *dest;
+    int size;
+    int nwords;
+    char types[2];
+} sret_t;
+
 /*
  * Copies the arguments from the given array to C stack, invoke the
  * target function, and copy the result back.
+ *
+ * A long result comes back in edx:eax.  Structs passed by value are
+ * simply more words on the stack, like longs and doubles.  A struct
+ * result of 1, 2, 4 or 8 bytes comes back in eax and edx; any other is
+ * written through a hidden pointer pushed after the arguments, which
+ * the caller pops under the C convention and the callee under stdcall.
  */
 void asm_dispatch(void *func,
 		  int nwords,
@@ -68,6 +87,18 @@ void asm_dispatch(void *func,
 		  long *resP,
 		  int conv)
 {
+    sret_t *sret = 0;
+    void *hidden = 0;		/* hidden result pointer, if any */
+    long regs[2];		/* eax and edx after the call */
+
+    if (res_type == TY_STRUCT) {
+        sret = (sret_t *)resP;
+	if (sret->size != 1 && sret->size != 2 && sret->size != 4 &&
+	    sret->size != 8) {
+	    hidden = sret->dest;
+	}
+    }
+
     __asm {
 
 	mov esi, args
@@ -86,20 +117,39 @@ void asm_dispatch(void *func,
 	jge SHORT args_loop
 
     args_done:
+	mov eax, hidden
+	or eax, eax
+	jz no_hidden
+	push eax
+
+    no_hidden:
 	call func
+	mov regs[0], eax
+	mov regs[4], edx
 
 	mov edx, conv
         or edx, edx
 	jnz is_stdcall
 
-	// pop arguments
+	// pop arguments, and the hidden pointer if pushed
 	mov edx, nwords
         shl edx, 2
         add esp, edx
+	mov edx, hidden
+	or edx, edx
+	jz is_stdcall
+	add esp, 4
 
 is_stdcall:
-        mov esi, resP
+	// long and struct results are copied below from eax and edx;
+	// the FPU stack is empty
 	mov edx, res_type
+	cmp edx, TY_STRUCT
+	je done
+	cmp edx, TY_LONG
+	je done
+
+        mov esi, resP
 	dec edx
 	jge not_p64
 
@@ -130,4 +180,10 @@ is_stdcall:
 
     done:
     }
+
+    if (res_type == TY_LONG) {
+        memcpy(resP, regs, 8);
+    } else if (sret != 0 && hidden == 0) {
+        memcpy(sret->dest, regs, sret->size);
+    }
 }